@@ -1,9 +1,12 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
+// It starts with NBUF buffers, grows by a page of buffers on a miss
+// while free memory lasts, up to NBUFMAX, and gives pages back
+// when kalloc() runs out.
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
@@ -12,6 +15,15 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Write-back: a buffer holding file data can instead be marked
+// dirty with bdirty(), which pins it until the flusher thread
+// writes it back, in batches sorted by block number, FLUSHTICKS
+// after the last batch or as soon as a quarter of the cache is
+// dirty. Writers wait once half of it is. A fresh buffer is a
+// newly allocated block; the log writes those with bflush()
+// before it commits their allocation, so that a crash can't
+// leave a file pointing at what a block held before.
 
 
 #include "types.h"
@@ -22,70 +34,319 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "bstat.h"
+#include "proc.h"
+
+#define NBUCKET 13
+#define BHASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
+
+// buffer data is allocated a page, i.e. a group of BPP buffers, at a time.
+#define BPP (PGSIZE / BSIZE)
+#define NGROUP (NBUFMAX / BPP)
+#define MINGROUP ((NBUF + BPP - 1) / BPP)
 
 struct {
+  // serializes recycling, growing and shrinking, so that
+  // two processes don't both allocate a buffer for the
+  // same block. protects group[] and nbuf.
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf buf[NBUFMAX];
+  char *group[NGROUP];  // data of buf[g*BPP..(g+1)*BPP-1], or 0
+  int nbuf;             // buffers with data
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  // Hash table of buffers by (dev, blockno), chained through next.
+  // Each bucket has its own lock, which protects the chain and
+  // the refcnt, lastuse, dev and blockno of the buffers on it.
+  struct {
+    struct spinlock lock;
+    struct buf *head;
+    uint hits;
+  } bucket[NBUCKET];
+
+  uint stamp;  // source of buf.lastuse values
+  uint misses;
+  uint evictions;
+  uint grows;
+  uint shrinks;
+  uint readahead;
+  uint aheadhits;
+  int inflight;  // breadahead() reads not yet finished
+  int ndirty;    // buffers marked by bdirty() and not yet written
 } bcache;
 
+// Give the buffers of group g the page of data pa, and
+// put them in bucket 0, where a zeroed dev and blockno hash
+// to, as the first candidates for recycling.
+// Caller must hold bcache.lock.
+static void
+baddgroup(int g, char *pa)
+{
+  struct buf *b;
+
+  bcache.group[g] = pa;
+  bcache.nbuf += BPP;
+  acquire(&bcache.bucket[0].lock);
+  for(b = &bcache.buf[g*BPP]; b < &bcache.buf[(g+1)*BPP]; b++){
+    b->data = (uchar*)pa + (b - &bcache.buf[g*BPP]) * BSIZE;
+    b->dev = 0;
+    b->blockno = 0;
+    b->valid = 0;
+    b->ahead = 0;
+    b->refcnt = 0;
+    b->lastuse = 0;
+    b->next = bcache.bucket[0].head;
+    bcache.bucket[0].head = b;
+  }
+  release(&bcache.bucket[0].lock);
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  char *pa;
 
   initlock(&bcache.lock, "bcache");
-
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  for(int i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
+  for(b = bcache.buf; b < bcache.buf+NBUFMAX; b++)
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+
+  // kalloc() may call bshrink(), so it can't be
+  // called holding bcache.lock.
+  for(int g = 0; g < MINGROUP; g++){
+    if((pa = kalloc()) == 0)
+      panic("binit");
+    acquire(&bcache.lock);
+    baddgroup(g, pa);
+    release(&bcache.lock);
   }
 }
 
+// Look for block blockno on dev in bucket h,
+// whose lock must be held. Takes a reference
+// to the buffer if it's there.
+static struct buf*
+bfind(int h, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bcache.bucket[h].head; b; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      return b;
+    }
+  }
+  return 0;
+}
+
+// Remove b from bucket h, whose lock must be held.
+static void
+bunlink(int h, struct buf *b)
+{
+  struct buf **pb;
+
+  for(pb = &bcache.bucket[h].head; *pb != b; pb = &(*pb)->next)
+    ;
+  *pb = b->next;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
 static struct buf*
 bget(uint dev, uint blockno)
 {
-  struct buf *b;
+  struct buf *b, *victim;
+  int h = BHASH(dev, blockno), vh;
+  char *pa = 0;
+
+  acquire(&bcache.bucket[h].lock);
+  b = bfind(h, dev, blockno);
+  if(b)
+    bcache.bucket[h].hits++;
+  release(&bcache.bucket[h].lock);
+  if(b){
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Not cached. Grow the cache rather than recycle a buffer
+  // if memory isn't short. kalloc() may call bshrink(), so
+  // it can't be called holding bcache.lock.
+  if(bcache.nbuf < NBUFMAX && kfreepages() > BUFRESERVE)
+    pa = kalloc();
 
+  // Another process may be recycling a buffer for the
+  // same block, so look again once we're the only one.
+again:
   acquire(&bcache.lock);
+  acquire(&bcache.bucket[h].lock);
+  b = bfind(h, dev, blockno);
+  if(b)
+    bcache.bucket[h].hits++;
+  release(&bcache.bucket[h].lock);
+  if(b){
+    release(&bcache.lock);
+    if(pa)
+      kfree(pa);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  bcache.misses++;
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  if(pa){
+    for(int g = 0; g < NGROUP; g++){
+      if(bcache.group[g] == 0){
+        baddgroup(g, pa);
+        bcache.grows++;
+        pa = 0;
+        break;
+      }
     }
+    if(pa)
+      kfree(pa);
   }
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Recycle the least recently released unused buffer.
+  // Keep the lock of the bucket holding the best candidate
+  // so far, so that no one can start using it.
+  victim = 0;
+  vh = -1;
+  for(int i = 0; i < NBUCKET; i++){
+    int better = 0;
+    acquire(&bcache.bucket[i].lock);
+    for(b = bcache.bucket[i].head; b; b = b->next){
+      if(b->refcnt == 0 && (victim == 0 || b->lastuse < victim->lastuse)){
+        victim = b;
+        better = 1;
+      }
     }
+    if(better){
+      if(vh >= 0)
+        release(&bcache.bucket[vh].lock);
+      vh = i;
+    } else {
+      release(&bcache.bucket[i].lock);
+    }
+  }
+  if(victim == 0){
+    // every buffer is in use, e.g. pinned by the log until
+    // it is installed. grow the cache even though memory
+    // is short; only fail if there's no memory at all.
+    int full = bcache.nbuf >= NBUFMAX;
+    release(&bcache.lock);
+    if(full || (pa = kalloc()) == 0)
+      panic("bget: no buffers");
+    goto again;
   }
-  panic("bget: no buffers");
+  if(victim->valid)
+    bcache.evictions++;
+  bunlink(vh, victim);
+  release(&bcache.bucket[vh].lock);
+
+  acquire(&bcache.bucket[h].lock);
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->valid = 0;
+  victim->ahead = 0;
+  victim->refcnt = 1;
+  victim->next = bcache.bucket[h].head;
+  bcache.bucket[h].head = victim;
+  release(&bcache.bucket[h].lock);
+  release(&bcache.lock);
+
+  acquiresleep(&victim->lock);
+  return victim;
+}
+
+// Give a page of buffer data back to kalloc(), if there
+// is a group of buffers beyond the first NBUF that no one
+// is using. Unused buffers hold no unwritten data, since
+// the log pins the ones it hasn't installed yet, and
+// bdirty() the ones the flusher hasn't written.
+// Called by kalloc() when it runs out of pages.
+// Returns 1 if it freed a page, 0 if not.
+int
+bshrink(void)
+{
+  struct buf *b;
+  char *pa = 0;
+  int hs[BPP], n, i, j, busy;
+
+  acquire(&bcache.lock);
+  for(int g = NGROUP-1; g >= MINGROUP && pa == 0; g--){
+    if(bcache.group[g] == 0)
+      continue;
+
+    // lock the group's buckets, in order, each once.
+    // buffers only move between buckets in bget(),
+    // which holds bcache.lock.
+    n = 0;
+    for(b = &bcache.buf[g*BPP]; b < &bcache.buf[(g+1)*BPP]; b++){
+      int h = BHASH(b->dev, b->blockno);
+      for(i = 0; i < n && hs[i] < h; i++)
+        ;
+      if(i < n && hs[i] == h)
+        continue;
+      for(j = n; j > i; j--)
+        hs[j] = hs[j-1];
+      hs[i] = h;
+      n++;
+    }
+    for(i = 0; i < n; i++)
+      acquire(&bcache.bucket[hs[i]].lock);
+
+    busy = 0;
+    for(b = &bcache.buf[g*BPP]; b < &bcache.buf[(g+1)*BPP]; b++)
+      busy |= b->refcnt != 0;
+    if(!busy){
+      for(b = &bcache.buf[g*BPP]; b < &bcache.buf[(g+1)*BPP]; b++){
+        bunlink(BHASH(b->dev, b->blockno), b);
+        b->data = 0;
+      }
+      pa = bcache.group[g];
+      bcache.group[g] = 0;
+      bcache.nbuf -= BPP;
+      bcache.shrinks++;
+    }
+
+    for(i = n-1; i >= 0; i--)
+      release(&bcache.bucket[hs[i]].lock);
+  }
+  release(&bcache.lock);
+
+  if(pa == 0)
+    return 0;
+  kfree(pa);
+  return 1;
+}
+
+// Copy the buffer cache's counters to user address addr.
+int
+bstat(uint64 addr)
+{
+  struct bstat st;
+
+  acquire(&bcache.lock);
+  st.nbuf = bcache.nbuf;
+  st.maxbuf = NBUFMAX;
+  st.misses = bcache.misses;
+  st.evictions = bcache.evictions;
+  st.grows = bcache.grows;
+  st.shrinks = bcache.shrinks;
+  st.readahead = bcache.readahead;
+  st.aheadhits = bcache.aheadhits;
+  release(&bcache.lock);
+  st.hits = 0;
+  for(int i = 0; i < NBUCKET; i++){
+    acquire(&bcache.bucket[i].lock);
+    st.hits += bcache.bucket[i].hits;
+    release(&bcache.bucket[i].lock);
+  }
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -99,9 +360,95 @@ bread(uint dev, uint blockno)
     virtio_disk_rw(b, 0);
     b->valid = 1;
   }
+  if(b->ahead){
+    b->ahead = 0;
+    __sync_fetch_and_add(&bcache.aheadhits, 1);
+  }
+  return b;
+}
+
+// Return a locked buf for block blockno of dev, which has
+// just been allocated, filled with zeros rather than read.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->valid = 1;
   return b;
 }
 
+// Return 1 if block blockno of dev is in the cache
+// (or on its way there), 0 if not.
+int
+bcached(uint dev, uint blockno)
+{
+  struct buf *b;
+  int h = BHASH(dev, blockno);
+
+  acquire(&bcache.bucket[h].lock);
+  for(b = bcache.bucket[h].head; b; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  }
+  release(&bcache.bucket[h].lock);
+  return b != 0;
+}
+
+// Start reading block blockno of dev into the cache,
+// if it isn't there already, without waiting for it.
+// The buffer stays locked until the read finishes;
+// see bdone().
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  // don't tie up more than a quarter of the cache.
+  if(bcache.inflight >= bcache.nbuf / 4 || bcached(dev, blockno))
+    return;
+  b = bget(dev, blockno);
+  if(b->valid){
+    // someone else read it in the meantime.
+    brelse(b);
+    return;
+  }
+  b->ahead = 1;
+  __sync_fetch_and_add(&bcache.readahead, 1);
+  __sync_fetch_and_add(&bcache.inflight, 1);
+  virtio_disk_start(b);
+}
+
+// Send reads started by breadahead() to the disk now,
+// rather than when someone next waits for the disk.
+void
+bkick(void)
+{
+  virtio_disk_kick();
+}
+
+// Called by the disk driver, from an interrupt, when
+// a read started by breadahead() has finished.
+// Does what brelse() does for the process that locked b.
+void
+bdone(struct buf *b)
+{
+  int h;
+
+  b->valid = 1;
+  __sync_fetch_and_sub(&bcache.inflight, 1);
+  releasesleep(&b->lock);
+
+  h = BHASH(b->dev, b->blockno);
+  acquire(&bcache.bucket[h].lock);
+  b->refcnt--;
+  if (b->refcnt == 0)
+    b->lastuse = __sync_fetch_and_add(&bcache.stamp, 1);
+  release(&bcache.bucket[h].lock);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,43 +458,223 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Start writing b's contents to disk, without waiting.
+// Must be locked, and stay locked and unmodified until
+// bwait(b), so that the caller can have several writes
+// in flight at once. The disk driver holds the write
+// until someone waits, so that writes started together
+// to adjacent blocks go to the disk as one request.
+void
+bwritestart(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwritestart");
+  virtio_disk_submit(b, 1);
+}
+
+// Wait for the write started by bwritestart(b).
+void
+bwait(struct buf *b)
+{
+  virtio_disk_wait(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// If no one else is using it, note when, for bget()'s LRU.
 void
 brelse(struct buf *b)
 {
+  int h;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  h = BHASH(b->dev, b->blockno);
+  acquire(&bcache.bucket[h].lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+    b->lastuse = __sync_fetch_and_add(&bcache.stamp, 1);
+  }
+  release(&bcache.bucket[h].lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int h = BHASH(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[h].lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bcache.bucket[h].lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int h = BHASH(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[h].lock);
   b->refcnt--;
+  release(&bcache.bucket[h].lock);
+}
+
+// Caller has modified b->data, which holds file data, and
+// leaves writing it to the flusher. Pins b until then. fresh
+// says b is a newly allocated block. Waits if too much of
+// the cache is dirty.
+void
+bdirty(struct buf *b, int fresh)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bdirty");
+
+  acquire(&bcache.lock);
+  if(!b->dirty){
+    b->dirty = 1;
+    bcache.ndirty++;
+    bpin(b);
+  }
+  if(fresh)
+    b->fresh = 1;
+  while(bcache.ndirty >= bcache.nbuf / 2)
+    sleep(&bcache.ndirty, &bcache.lock);
+  release(&bcache.lock);
+}
+
+// b has been written, or no longer needs to be.
+// Caller holds bcache.lock.
+static void
+bclean(struct buf *b)
+{
+  if(b->dirty){
+    b->dirty = 0;
+    b->fresh = 0;
+    bcache.ndirty--;
+    bunpin(b);
+    wakeup(&bcache.ndirty);
+  }
+}
+
+// Block blockno of dev has been freed. Drop any data
+// bdirty() left for it, which mustn't reach the disk
+// once the block is reused, perhaps by the log.
+void
+bforget(uint dev, uint blockno)
+{
+  struct buf *b;
+  int h = BHASH(dev, blockno);
+
+  acquire(&bcache.lock);
+  acquire(&bcache.bucket[h].lock);
+  for(b = bcache.bucket[h].head; b; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  }
+  release(&bcache.bucket[h].lock);
+  if(b)
+    bclean(b);
   release(&bcache.lock);
 }
 
+// Wait for the writes of the n locked buffers in bs.
+static void
+bfinish(struct buf **bs, int n)
+{
+  for(int i = 0; i < n; i++){
+    bwait(bs[i]);
+    acquire(&bcache.lock);
+    bclean(bs[i]);
+    release(&bcache.lock);
+    brelse(bs[i]);
+  }
+}
+
+// Write dirty buffers (only fresh ones, if fresh is set)
+// to disk, in one pass over the cache, in batches sorted by
+// block number so that the disk driver can merge adjacent
+// ones. If wait is set, waits for buffers that others are
+// using; otherwise leaves them for next time.
+static void
+flush(int fresh, int wait)
+{
+  struct buf *b, *batch[FLUSHBATCH];
+  int i, j, n, m, next;
+
+  for(next = 0; next < NBUFMAX; ){
+    n = 0;
+    acquire(&bcache.lock);
+    for(; next < NBUFMAX && n < FLUSHBATCH; next++){
+      b = &bcache.buf[next];
+      if(b->dirty && (b->fresh || !fresh)){
+        bpin(b);  // keep it while we get its lock
+        batch[n++] = b;
+      }
+    }
+    release(&bcache.lock);
+
+    for(i = 1; i < n; i++){
+      b = batch[i];
+      for(j = i; j > 0 && batch[j-1]->blockno > b->blockno; j--)
+        batch[j] = batch[j-1];
+      batch[j] = b;
+    }
+
+    m = 0;
+    for(i = 0; i < n; i++){
+      b = batch[i];
+      if(!tryacquiresleep(&b->lock)){
+        if(!wait){
+          bunpin(b);
+          continue;
+        }
+        // don't hold buffers while waiting for another;
+        // its owner may be waiting for one of them.
+        bfinish(batch, m);
+        m = 0;
+        acquiresleep(&b->lock);
+      }
+      if(b->dirty){
+        bwritestart(b);
+        batch[m++] = b;
+      } else {
+        brelse(b);
+      }
+    }
+    bfinish(batch, m);
+  }
+}
+
+// Write the fresh dirty buffers, or all of them, to disk,
+// waiting until they're written.
+void
+bflush(int all)
+{
+  flush(!all, 1);
+}
+
+// The flusher kernel thread. Once a tick, writes back dirty
+// buffers if a quarter of the cache is dirty or FLUSHTICKS
+// have passed since it last did.
+void
+bflusher(void)
+{
+  uint t0, last = 0;
+
+  for(;;){
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < 1)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
 
+    if(bcache.ndirty == 0){
+      last = ticks;
+      continue;
+    }
+    if(bcache.ndirty >= bcache.nbuf / 4 || ticks - last >= FLUSHTICKS){
+      flush(0, 0);
+      last = ticks;
+    }
+  }
+}
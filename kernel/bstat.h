@@ -0,0 +1,19 @@
+// bstat.h - Buffer cache statistics, filled in by the bstat() syscall
+// Shared between kernel and user space
+
+#ifndef _BSTAT_H_
+#define _BSTAT_H_
+
+struct bstat {
+  uint nbuf;       // buffers currently allocated
+  uint maxbuf;     // most buffers the cache will grow to
+  uint hits;       // lookups that found the block cached
+  uint misses;     // lookups that had to read the block
+  uint evictions;  // cached blocks dropped to make room
+  uint grows;      // pages of buffers added
+  uint shrinks;    // pages of buffers given back to kalloc()
+  uint readahead;  // blocks read ahead of sequential reads
+  uint aheadhits;  // of those, blocks later read
+};
+
+#endif // _BSTAT_H_
@@ -1,12 +1,18 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int ahead;   // read by breadahead() and not yet by bread()?
+  int dirty;   // written by bdirty(), not yet to disk?
+  int fresh;   // dirty, and newly allocated?
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
-  uchar data[BSIZE];
+  uint lastuse;     // when refcnt last dropped to 0 (see brelse)
+  struct buf *next; // hash bucket chain
+  struct buf *qnext; // virtio_disk.c's queue, then the request b is in
+  char qwrite;       // queued to be written, not read?
+  char qasync;       // started by virtio_disk_start()?
+  uchar *data;      // BSIZE bytes, in a page shared with other bufs
 };
 
@@ -0,0 +1,146 @@
+// Name cache.
+//
+// Remembers what dirlookup() found for (directory, name)
+// pairs, so that looking up a hot path again doesn't read
+// directory blocks. An entry with inum 0 is negative: it
+// records that the directory has no such name.
+//
+// Entries change only with the directory's inode locked:
+// dirlookup() adds what it found, dirlink() and unlink()
+// update the entry for the name they change, and freeing
+// a directory's inode drops all of its entries.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+
+#define NDBUCKET 61
+
+struct dentry {
+  uint dev;
+  uint dir;              // inum of the directory
+  char name[DIRSIZ];
+  uint inum;             // 0 if dir has no such name
+  uint lastuse;          // for LRU replacement
+  struct dentry *next;   // hash bucket chain
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDENTRY];
+  struct dentry *bucket[NDBUCKET];
+  uint stamp;
+} dcache;
+
+static uint
+dchash(uint dev, uint dir, char *name)
+{
+  uint h = dev * 31 + dir;
+  int i;
+
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDBUCKET;
+}
+
+void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+// Caller holds dcache.lock.
+static struct dentry*
+dcfind(uint h, uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.bucket[h]; d; d = d->next){
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
+  }
+  return 0;
+}
+
+// Caller holds dcache.lock.
+static void
+dcunlink(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.bucket[dchash(d->dev, d->dir, d->name)]; *pp; pp = &(*pp)->next){
+    if(*pp == d){
+      *pp = d->next;
+      break;
+    }
+  }
+  d->dir = 0;
+}
+
+// Look up name in directory dir. If the cache knows the
+// answer, set *inum (to 0 if there is no such name) and
+// return 1; otherwise return 0.
+int
+dcachelookup(uint dev, uint dir, char *name, uint *inum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  d = dcfind(dchash(dev, dir, name), dev, dir, name);
+  if(d){
+    *inum = d->inum;
+    d->lastuse = ++dcache.stamp;
+  }
+  release(&dcache.lock);
+  return d != 0;
+}
+
+// Record that name in directory dir is inode inum,
+// or, if inum is 0, that there is no such name.
+void
+dcacheenter(uint dev, uint dir, char *name, uint inum)
+{
+  struct dentry *d, *e;
+  uint h = dchash(dev, dir, name);
+
+  acquire(&dcache.lock);
+  if((d = dcfind(h, dev, dir, name)) == 0){
+    // recycle an unused entry, or else the least recently used.
+    d = &dcache.ent[0];
+    for(e = dcache.ent; e < &dcache.ent[NDENTRY]; e++){
+      if(e->dir == 0){
+        d = e;
+        break;
+      }
+      if(e->lastuse < d->lastuse)
+        d = e;
+    }
+    if(d->dir != 0)
+      dcunlink(d);
+    d->dev = dev;
+    d->dir = dir;
+    strncpy(d->name, name, DIRSIZ);
+    d->next = dcache.bucket[h];
+    dcache.bucket[h] = d;
+  }
+  d->inum = inum;
+  d->lastuse = ++dcache.stamp;
+  release(&dcache.lock);
+}
+
+// Forget all names in directory dir, which is being freed.
+void
+dcachepurge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < &dcache.ent[NDENTRY]; d++){
+    if(d->dir == dir && d->dev == dev)
+      dcunlink(d);
+  }
+  release(&dcache.lock);
+}
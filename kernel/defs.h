@@ -3,24 +3,42 @@ struct context;
 struct file;
 struct inode;
 struct pipe;
+struct pollent;
+struct pollq;
 struct proc;
+struct readahead;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritestart(struct buf*);
+void            bwait(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bshrink(void);
+int             bcached(uint, uint);
+void            breadahead(uint, uint);
+void            bkick(void);
+void            bdone(struct buf*);
+int             bstat(uint64);
+struct buf*     bnew(uint, uint);
+void            bdirty(struct buf*, int);
+void            bforget(uint, uint);
+void            bflush(int);
+void            bflusher(void);
 
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
+int             consolepoll(struct pollent*);
 
 // exec.c
 int             exec(char*, char**);
@@ -33,6 +51,17 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filesync(struct file*);
+int             filereadk(struct file*, char*, int);
+int             filewritek(struct file*, char*, int);
+int             filesplice(struct file*, struct file*, int);
+int             filepoll(struct file*, struct pollent*);
+
+// dcache.c
+void            dcacheinit(void);
+int             dcachelookup(uint, uint, char*, uint*);
+void            dcacheenter(uint, uint, char*, uint);
+void            dcachepurge(uint, uint);
 
 // fs.c
 void            fsinit(int);
@@ -53,6 +82,8 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+void            ireadahead(struct inode*, struct readahead*, uint, uint);
+int             istat(uint64);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -63,18 +94,42 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kdup(void *);
+void*           superalloc(void);
+void            ksplit(void *);
+int             krefcnt(void *);
+int             kfreepages(void);
+void*           kalloc_zeroed(void);
+void            kzeroer(void);
+int             memstat(uint64);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int);
+void            end_opn(int);
+int             log_maxop(void);
+void            log_sync(void);
+int             log_holds(uint);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             splicein(struct pipe*, struct file*, int);
+int             spliceout(struct pipe*, struct file*, int);
+int             splicepipe(struct pipe*, struct pipe*, int);
+int             pipepoll(struct pipe*, struct pollent*);
+
+// poll.c
+void            pollinit(void);
+void            pollregister(struct pollq*, struct pollent*);
+void            pollwake(struct pollq*);
+void            polltick(void);
+int             poll(uint64, int, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -85,6 +140,7 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+void            kthread(char*, void (*)(void), int);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
@@ -123,6 +179,7 @@ void            pop_off(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
@@ -161,6 +218,9 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+void            asidinit(void);
+uint64          uvmsatp(struct proc*);
+void            uvmflush(pagetable_t, uint64);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
@@ -177,6 +237,18 @@ int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
+// vma.c
+void            vmainit(void);
+int             vmfault(pagetable_t, uint64, int);
+void            vmprefault(uint64, uint64, int);
+int             vmashare(struct proc*);
+int             vmadup(struct proc*, struct proc*);
+void            vmaput(pagetable_t, struct vma*);
+uint64          mmapbase(struct proc*);
+uint64          mmap(uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+void            textdrop(struct inode*);
+
 // plic.c
 void            plicinit(void);
 void            plicinithart(void);
@@ -186,6 +258,10 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf *, int);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_start(struct buf *);
+void            virtio_disk_kick(void);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -5,10 +5,11 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 #include "elf.h"
 
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
-
 int flags2perm(int flags)
 {
     int perm = 0;
@@ -28,9 +29,13 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma seg[NVMA], *v;
+  int nseg = 0;
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
+  memset(seg, 0, sizeof(seg));
+
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -49,7 +54,8 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Describe the program's segments. Nothing is read yet:
+  // vmfault() loads each page from ip when it is first used.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -61,12 +67,25 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+    if(ph.vaddr < PGROUNDUP(sz))
+      goto bad; // segments must not share pages.
+    if(ph.vaddr + ph.memsz >= TRAPFRAME - 2*PGSIZE)
+      goto bad; // leave room for the stack.
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.memsz == 0)
+      continue;
+    if(nseg >= NVMA)
       goto bad;
+    v = &seg[nseg++];
+    v->used = 1;
+    v->start = ph.vaddr;
+    v->end = ph.vaddr + ph.memsz;
+    v->fileend = ph.vaddr + ph.filesz;
+    v->off = ph.off;
+    v->perm = PTE_R | PTE_U | flags2perm(ph.flags);
+    v->ip = idup(ip);
+    sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
@@ -121,8 +140,11 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  vmaput(p->pagetable, p->vma);
+  memmove(p->vma, seg, sizeof(seg));
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  p->asidgen = 0; // entries tagged with the old ASID are stale.
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
@@ -137,30 +159,6 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  vmaput(0, seg);
   return -1;
 }
-
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
-{
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
-  return 0;
-}
@@ -10,6 +10,7 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
 #include "stat.h"
 #include "proc.h"
 
@@ -101,6 +102,133 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Make everything written to file f durable. Dirty data isn't
+// tracked per file, so this writes all of it, and then commits
+// and installs the log.
+int
+filesync(struct file *f)
+{
+  if(f->type != FD_INODE)
+    return -1;
+  bflush(1);
+  log_sync();
+  return 0;
+}
+
+// Read from inode f at its offset; addr is a user
+// virtual address if user is set, or a kernel address.
+static int
+inoderead(struct file *f, int user, uint64 addr, int n)
+{
+  int r;
+
+  ilock(f->ip);
+  ireadahead(f->ip, &f->ra, f->off, n);
+  if((r = readi(f->ip, user, addr, f->off, n)) > 0)
+    f->off += r;
+  iunlock(f->ip);
+  return r;
+}
+
+// Write to inode f at its offset, a transaction at a time.
+// addr is as for inoderead().
+static int
+inodewrite(struct file *f, int user, uint64 addr, int n)
+{
+  int r;
+
+  // write as many blocks at a time as one FS operation
+  // may reserve in the log, including i-node, indirect
+  // block, allocation blocks, and 2 blocks of slop for
+  // non-aligned writes. this really belongs lower down,
+  // since writei() might be writing a device like the console.
+  int nop = log_maxop();
+  int max = ((nop-1-1-2) / 2) * BSIZE;
+  int i = 0;
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    begin_opn(nop);
+    ilock(f->ip);
+    if ((r = writei(f->ip, user, addr + i, f->off, n1)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+    end_opn(nop);
+
+    if(r != n1){
+      // error from writei
+      break;
+    }
+    i += r;
+  }
+  return i == n ? n : -1;
+}
+
+// Read from file f, which must be an inode, into kernel
+// memory, for splice().
+int
+filereadk(struct file *f, char *dst, int n)
+{
+  if(f->type != FD_INODE)
+    panic("filereadk");
+  return inoderead(f, 0, (uint64)dst, n);
+}
+
+// Write to file f, which must be an inode, from kernel
+// memory, for splice().
+int
+filewritek(struct file *f, char *src, int n)
+{
+  if(f->type != FD_INODE)
+    panic("filewritek");
+  return inodewrite(f, 0, (uint64)src, n);
+}
+
+// Move up to n bytes from file in to file out inside the
+// kernel, through the pages of a pipe rather than a user
+// buffer. One of them must be a pipe, and the other a pipe
+// or an inode.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_PIPE && out->type == FD_PIPE)
+    return splicepipe(in->pipe, out->pipe, n);
+  if(in->type == FD_INODE && out->type == FD_PIPE)
+    return splicein(out->pipe, in, n);
+  if(in->type == FD_PIPE && out->type == FD_INODE)
+    return spliceout(in->pipe, out, n);
+  return -1;
+}
+
+// For poll(): which POLL* events hold for file f. Puts e,
+// if not 0, on the wait queue of whatever f reads from or
+// writes to, if it can ever make poll() wait.
+int
+filepoll(struct file *f, struct pollent *e)
+{
+  int mask = 0;
+
+  if(f->type == FD_PIPE){
+    if(f->readable)
+      mask |= POLLIN | POLLHUP;
+    if(f->writable)
+      mask |= POLLOUT | POLLERR;
+    return pipepoll(f->pipe, e) & mask;
+  }
+  if(f->readable)
+    mask |= POLLIN;
+  if(f->writable)
+    mask |= POLLOUT;
+  if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV &&
+     devsw[f->major].poll)
+    return devsw[f->major].poll(e) & mask;
+  return mask;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -118,10 +246,7 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    r = inoderead(f, 1, addr, n);
   } else {
     panic("fileread");
   }
@@ -134,7 +259,7 @@ fileread(struct file *f, uint64 addr, int n)
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
@@ -146,33 +271,7 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
-    }
-    ret = (i == n ? n : -1);
+    ret = inodewrite(f, 1, addr, n);
   } else {
     panic("filewrite");
   }
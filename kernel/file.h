@@ -7,6 +7,11 @@ struct file {
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
   short major;       // FD_DEVICE
+  struct readahead {  // FD_INODE; see ireadahead()
+    int last;         // last block read, or -1
+    uint next;        // first block not yet read ahead
+    uint win;         // blocks to read ahead; 0 if not sequential
+  } ra;
 };
 
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
@@ -18,21 +23,40 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // itable hash chain
+  struct inode *lprev, *lnext; // itable LRU list, while ref is 0
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  int textcached;     // vma.c may have cached pages of it
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+3];
+};
+
+// poll() wait queues; see poll.c.
+struct pollwait {
+  int fired;             // has a queue been woken?
+};
+
+struct pollent {
+  struct pollwait *w;    // the poll() this is for
+  struct pollq *q;       // queue it's on, or 0
+  struct pollent *next;  // next on q
+};
+
+struct pollq {
+  struct pollent *head;
 };
 
 // map major device number to device functions.
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*poll)(struct pollent*);  // ready POLL* events; joins the queue
 };
 
 extern struct devsw devsw[];
@@ -20,12 +20,24 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "istat.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
 
+// In-memory summary of what is free on disk, so that balloc()
+// and ialloc() can skip bitmap and inode blocks with nothing
+// free, and carry on from where they last allocated (next fit)
+// rather than from the start of the disk every time.
+static struct {
+  int nbfree[NBMAP];    // free blocks under each bitmap block
+  int nifree[NIBLOCK];  // free inodes in each inode block
+  uint bhint;           // block where balloc() starts looking
+  uint ihint;           // inum where ialloc() starts looking
+} fsum;
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -37,6 +49,38 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+// Count what is free under each bitmap and inode block.
+static void
+fsuminit(int dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  uint b, inum;
+  int bi, i;
+
+  if((sb.size + BPB - 1) / BPB > NBMAP || sb.ninodes / IPB + 1 > NIBLOCK)
+    panic("fsuminit: disk too big");
+
+  for(b = 0; b < sb.size; b += BPB){
+    bp = bread(dev, BBLOCK(b, sb));
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        fsum.nbfree[b / BPB]++;
+    }
+    brelse(bp);
+  }
+  for(inum = 0; inum < sb.ninodes; inum += IPB){
+    bp = bread(dev, IBLOCK(inum, sb));
+    dip = (struct dinode*)bp->data;
+    for(i = 0; i < IPB && inum + i < sb.ninodes; i++){
+      if(inum + i != 0 && dip[i].type == 0)
+        fsum.nifree[inum / IPB]++;
+    }
+    brelse(bp);
+  }
+  fsum.ihint = 1;
+}
+
 // Init fs
 void
 fsinit(int dev) {
@@ -44,47 +88,122 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  fsuminit(dev);
+  kthread("flusher", bflusher, KTHREADPRIO);
 }
 
-// Zero a block.
+// Does file ip's data go to the disk with bdirty(),
+// rather than through the log?
+#define WBDATA(ip) (WRITEBACK && (ip)->type == T_FILE)
+
+// Zero a newly allocated block: through the log, or if data
+// is set, in the cache, for the flusher to write.
 static void
-bzero(int dev, int bno)
+bzero(int dev, int bno, int data)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  bp = bnew(dev, bno);
+  if(data)
+    bdirty(bp, 1);
+  else
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Mark block b in use and zero it, if it is free. data
+// says b will hold file data written back by bdirty().
+// Returns 0 if someone already has it.
+static int
+bclaim(uint dev, uint b, int data)
+{
+  struct buf *bp;
+  int bi, m;
+
+  bp = bread(dev, BBLOCK(b, sb));
+  bi = b % BPB;
+  m = 1 << (bi % 8);
+  if(bp->data[bi/8] & m){
+    brelse(bp);
+    return 0;
+  }
+  bp->data[bi/8] |= m;  // Mark block in use.
+  log_write(bp);
+  __sync_fetch_and_sub(&fsum.nbfree[b / BPB], 1);
+  brelse(bp);
+  // a block the log still holds an older copy of must be
+  // zeroed through the log too, or recovery could put that
+  // copy back over the file's data.
+  bzero(dev, b, data && !log_holds(b));
+  return 1;
+}
+
+// Allocate a zeroed disk block: goal, if it is non-zero and
+// free, so that a file can grow in place; otherwise the start
+// of the next run of want free blocks after the last one
+// handed out, so that it has room to keep growing; otherwise
+// the next free block. data is as for bclaim().
 // returns 0 if out of disk space.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal, uint want, int data)
 {
-  int b, bi, m;
+  uint b, n, skip, run, first, start;
+  int bi, m;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+  if(goal != 0 && goal < sb.size && bclaim(dev, goal, data))
+    return goal;
+
+  for(;;){
+    // block 0 is the boot block, never free, so 0 means none.
+    first = start = 0;
+    run = 0;
+    bp = 0;
+    for(n = 0; n < sb.size && start == 0; n++){
+      b = (fsum.bhint + n) % sb.size;
+      if(b == 0)
+        run = 0;  // runs don't wrap around the end of the disk
+      if(bp == 0 || b % BPB == 0){
+        if(bp)
+          brelse(bp);
+        bp = 0;
+        if(fsum.nbfree[b / BPB] == 0){
+          // nothing free under this bitmap block.
+          skip = min(BPB - 1 - b % BPB, sb.size - 1 - b);
+          n += skip;
+          run = 0;
+          continue;
+        }
+        bp = bread(dev, BBLOCK(b, sb));
+      }
+      bi = b % BPB;
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+        if(first == 0)
+          first = b;
+        if(++run >= want)
+          start = b - run + 1;
+      } else {
+        run = 0;
       }
     }
-    brelse(bp);
+    if(bp)
+      brelse(bp);
+    if(start == 0)
+      start = first;
+    if(start == 0){
+      printf("balloc: out of blocks\n");
+      return 0;
+    }
+    // the bitmap wasn't locked between looking and
+    // claiming, so someone else may have got there first.
+    if(bclaim(dev, start, data)){
+      fsum.bhint = start + want;
+      return start;
+    }
   }
-  printf("balloc: out of blocks\n");
-  return 0;
 }
 
 // Free a disk block.
@@ -101,7 +220,9 @@ bfree(int dev, uint b)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  __sync_fetch_and_add(&fsum.nbfree[b / BPB], 1);
   brelse(bp);
+  bforget(dev, b);
 }
 
 // Inodes.
@@ -129,18 +250,20 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and current
+//   directories). iget() finds or creates a table entry and
+//   increments its ref; iput() decrements ref. An entry whose
+//   ref is zero keeps its contents, on an LRU list, so that
+//   another iget() of the same inode can find it, until
+//   iget() recycles it for a different inode.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
-//   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ilock() reads the inode from the disk and sets
+//   ip->valid, while iget() clears ip->valid when it
+//   recycles an entry and iput() clears it when it frees
+//   the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -165,17 +288,29 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// entries, the hash chains and the LRU list. Since ip->ref
+// indicates whether an entry is in use, and ip->dev and ip->inum
+// indicate which i-node an entry holds, one must hold itable.lock
+// while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIBUCKET 61
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIBUCKET)
+
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct inode *bucket[NIBUCKET];
+
+  // LRU list of entries with ref 0. lru.lnext is the
+  // least recently used, and the next to be recycled.
+  struct inode lru;
+
+  uint hits;    // iget()s that found the inode in the table
+  uint misses;  // iget()s that recycled an entry for it
 } itable;
 
 void
@@ -184,11 +319,26 @@ iinit()
   int i = 0;
   
   initlock(&itable.lock, "itable");
+  itable.lru.lprev = &itable.lru;
+  itable.lru.lnext = &itable.lru;
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
+    itable.inode[i].lnext = &itable.lru;
+    itable.inode[i].lprev = itable.lru.lprev;
+    itable.lru.lprev->lnext = &itable.inode[i];
+    itable.lru.lprev = &itable.inode[i];
   }
 }
 
+// Take ip off the LRU list. Caller holds itable.lock.
+static void
+lruremove(struct inode *ip)
+{
+  ip->lprev->lnext = ip->lnext;
+  ip->lnext->lprev = ip->lprev;
+  ip->lprev = ip->lnext = 0;
+}
+
 static struct inode* iget(uint dev, uint inum);
 
 // Allocate an inode on device dev.
@@ -198,18 +348,28 @@ static struct inode* iget(uint dev, uint inum);
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  uint inum, n;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
+  // next fit, skipping inode blocks with nothing free.
+  for(n = 0; n < sb.ninodes; n++){
+    inum = (fsum.ihint + n) % sb.ninodes;
+    if(inum == 0)
+      continue;
+    if(fsum.nifree[inum / IPB] == 0){
+      n += IPB - 1 - inum % IPB;
+      continue;
+    }
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
+      __sync_fetch_and_sub(&fsum.nifree[inum / IPB], 1);
       brelse(bp);
+      fsum.ihint = inum + 1;
       return iget(dev, inum);
     }
     brelse(bp);
@@ -246,36 +406,73 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
+  uint h = IHASH(dev, inum);
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = itable.bucket[h]; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref == 0)
+        lruremove(ip);
       ip->ref++;
+      itable.hits++;
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Recycle the least recently used inode entry.
+  ip = itable.lru.lnext;
+  if(ip == &itable.lru)
     panic("iget: no inodes");
+  lruremove(ip);
+  if(ip->inum != 0){
+    for(pp = &itable.bucket[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->next)
+      ;
+    *pp = ip->next;
+  }
+  if(ip->textcached){
+    // unreferenced, so no process maps its cached pages,
+    // and a later write wouldn't know to drop them.
+    textdrop(ip);
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->next = itable.bucket[h];
+  itable.bucket[h] = ip;
+  itable.misses++;
   release(&itable.lock);
 
   return ip;
 }
 
+// Copy the inode table's counters to user address addr.
+int
+istat(uint64 addr)
+{
+  struct istat st;
+  struct inode *ip;
+
+  acquire(&itable.lock);
+  st.ninode = NINODE;
+  st.inuse = 0;
+  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
+    if(ip->ref > 0)
+      st.inuse++;
+  }
+  st.hits = itable.hits;
+  st.misses = itable.misses;
+  release(&itable.lock);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
 // Increment reference count for ip.
 // Returns ip to enable ip = idup(ip1) idiom.
 struct inode*
@@ -347,9 +544,12 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
+    if(ip->type == T_DIR)
+      dcachepurge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
+    __sync_fetch_and_add(&fsum.nifree[ip->inum / IPB], 1);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
@@ -358,6 +558,13 @@ iput(struct inode *ip)
   }
 
   ip->ref--;
+  if(ip->ref == 0){
+    // most recently used: put it at the end of the LRU list.
+    ip->lnext = &itable.lru;
+    ip->lprev = itable.lru.lprev;
+    itable.lru.lprev->lnext = ip;
+    itable.lru.lprev = ip;
+  }
   release(&itable.lock);
 }
 
@@ -374,20 +581,104 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. ip->addrs[NDIRECT+1]
+// is a doubly-indirect block, listing NINDIRECT blocks that
+// each list NINDIRECT more, and ip->addrs[NDIRECT+2] is a
+// triply-indirect block, one level deeper again.
+
+// Return the disk block address of the nth block of extent
+// file ip. If there is no such block, emap allocates one,
+// growing the last extent if the block after it is free, and
+// otherwise starting a new extent where want blocks are free.
+// returns 0 if out of disk space or out of extents.
+static uint
+emap(struct inode *ip, uint bn, uint want)
+{
+  struct buf *bp = 0;
+  uint *e = 0, *last = 0, base = 0, addr, eb;
+  int i;
+
+  for(i = 0; i < NEXTENT + NEXTENTBLK; i++){
+    if(i == NEXTENT){
+      if(ip->addrs[2*NEXTENT] == 0)
+        break;
+      bp = bread(ip->dev, ip->addrs[2*NEXTENT]);
+    }
+    e = i < NEXTENT ? &ip->addrs[2*i] : (uint*)bp->data + 2*(i - NEXTENT);
+    if(e[1] == 0)
+      break;
+    if(bn < base + e[1]){
+      addr = e[0] + (bn - base);
+      goto out;
+    }
+    base += e[1];
+    last = e;
+  }
+
+  // files have no holes, so bn must be the next block.
+  if(bn != base)
+    panic("emap: hole");
+
+  // grow the last extent if the block after it is free.
+  if(last){
+    addr = balloc(ip->dev, last[0] + last[1], want, WBDATA(ip));
+    if(addr == last[0] + last[1]){
+      last[1]++;
+      if(i > NEXTENT)  // last is in the extent block
+        log_write(bp);
+      goto out;
+    }
+  } else {
+    addr = balloc(ip->dev, 0, want, WBDATA(ip));
+  }
+  if(addr == 0)
+    goto out;
+
+  // start a new extent in slot i.
+  if(i == NEXTENT + NEXTENTBLK){
+    bfree(ip->dev, addr);
+    addr = 0;
+    goto out;
+  }
+  if(i == NEXTENT && bp == 0){
+    if((eb = balloc(ip->dev, 0, 1, 0)) == 0){
+      bfree(ip->dev, addr);
+      addr = 0;
+      goto out;
+    }
+    ip->addrs[2*NEXTENT] = eb;
+    bp = bread(ip->dev, eb);
+  }
+  e = i < NEXTENT ? &ip->addrs[2*i] : (uint*)bp->data + 2*(i - NEXTENT);
+  e[0] = addr;
+  e[1] = 1;
+  if(i >= NEXTENT)
+    log_write(bp);
+
+out:
+  if(bp)
+    brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one; want is
+// how many blocks the caller is about to add, as a hint
+// for extent files.
 // returns 0 if out of disk space.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, uint want)
 {
-  uint addr, *a;
+  uint addr, *a, span;
   struct buf *bp;
+  int level;
+
+  if(ip->type == T_FILE && ip->major == FEXTENT)
+    return emap(ip, bn, want);
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = balloc(ip->dev, 0, 1, WBDATA(ip));
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -396,28 +687,97 @@ bmap(struct inode *ip, uint bn)
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
+  // Find the tree holding bn: singly, doubly or triply
+  // indirect. span is how many blocks that tree maps.
+  span = NINDIRECT;
+  for(level = 0; level < 3 && bn >= span; level++){
+    bn -= span;
+    span *= NINDIRECT;
+  }
+  if(level == 3)
+    panic("bmap: out of range");
+
+  // Load the top indirect block, allocating if necessary.
+  if((addr = ip->addrs[NDIRECT+level]) == 0){
+    addr = balloc(ip->dev, 0, 1, 0);
+    if(addr == 0)
+      return 0;
+    ip->addrs[NDIRECT+level] = addr;
+  }
+
+  // Walk down through level+1 indirect blocks.
+  for(; level >= 0; level--){
+    span /= NINDIRECT;
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+    if((addr = a[bn / span]) == 0){
+      // at level 0 that's a data block.
+      addr = balloc(ip->dev, 0, 1, level == 0 && WBDATA(ip));
       if(addr){
-        a[bn] = addr;
+        a[bn / span] = addr;
         log_write(bp);
       }
     }
     brelse(bp);
-    return addr;
+    if(addr == 0)
+      return 0;
+    bn %= span;
   }
+  return addr;
+}
 
-  panic("bmap: out of range");
+// Free block addr and, if it is an indirect block with
+// depth levels of blocks below it, everything it lists.
+static void
+bfreetree(uint dev, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  if(depth > 0){
+    bp = bread(dev, addr);
+    a = (uint*)bp->data;
+    for(j = 0; j < NINDIRECT; j++){
+      if(a[j])
+        bfreetree(dev, a[j], depth - 1);
+    }
+    brelse(bp);
+  }
+  bfree(dev, addr);
+}
+
+// Free the len blocks starting at start.
+static void
+bfreerun(uint dev, uint start, uint len)
+{
+  uint b;
+
+  for(b = start; b < start + len; b++)
+    bfree(dev, b);
+}
+
+// Free all of extent file ip's blocks.
+static void
+efree(struct inode *ip)
+{
+  struct buf *bp;
+  uint *e;
+  int i;
+
+  for(i = 0; i < NEXTENT; i++){
+    bfreerun(ip->dev, ip->addrs[2*i], ip->addrs[2*i+1]);
+    ip->addrs[2*i] = ip->addrs[2*i+1] = 0;
+  }
+  if(ip->addrs[2*NEXTENT]){
+    bp = bread(ip->dev, ip->addrs[2*NEXTENT]);
+    e = (uint*)bp->data;
+    for(i = 0; i < NEXTENTBLK; i++)
+      bfreerun(ip->dev, e[2*i], e[2*i+1]);
+    brelse(bp);
+    bfree(ip->dev, ip->addrs[2*NEXTENT]);
+    ip->addrs[2*NEXTENT] = 0;
+  }
 }
 
 // Truncate inode (discard contents).
@@ -425,9 +785,17 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
+
+  if(ip->textcached)
+    textdrop(ip);
+
+  if(ip->type == T_FILE && ip->major == FEXTENT){
+    efree(ip);
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -436,16 +804,12 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  // the singly-, doubly- and triply-indirect trees.
+  for(i = 0; i < 3; i++){
+    if(ip->addrs[NDIRECT+i]){
+      bfreetree(ip->dev, ip->addrs[NDIRECT+i], i + 1);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
   ip->size = 0;
@@ -480,7 +844,7 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
+    uint addr = bmap(ip, off/BSIZE, 1);
     if(addr == 0)
       break;
     bp = bread(ip->dev, addr);
@@ -495,6 +859,60 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Sequential readahead. fileread() calls this before reading
+// n bytes at off from ip, with ra from the open file, so that the
+// disk reads the blocks after them while this read waits for and
+// copies its own. A read that starts in or just after the block
+// where the last one ended is sequential. The window follows the
+// hit rate: it doubles, up to RAMAX blocks, when a sequential read
+// finds one of its blocks missing from the cache, i.e. readahead
+// isn't keeping up, and halves, down to RAMIN, when all of them
+// were cached, so that it doesn't fill the cache for nothing. It
+// is dropped when a read isn't sequential.
+// Caller must hold ip->lock.
+void
+ireadahead(struct inode *ip, struct readahead *ra, uint off, uint n)
+{
+  uint first, last, bn, addr;
+  int miss = 0;
+
+  if(n == 0 || off >= ip->size || off + n < off)
+    return;
+  if(off + n > ip->size)
+    n = ip->size - off;
+  first = off / BSIZE;
+  last = (off + n - 1) / BSIZE;
+
+  if(ra->last < 0 ? first != 0 : (first != ra->last && first != ra->last + 1)){
+    ra->win = 0;
+    ra->next = 0;
+    ra->last = last;
+    return;
+  }
+  ra->last = last;
+
+  for(bn = first; bn <= last && !miss; bn++){
+    if((addr = bmap(ip, bn, 1)) != 0 && !bcached(ip->dev, addr))
+      miss = 1;
+  }
+  if(ra->win == 0)
+    ra->win = RAMIN;
+  else if(miss && ra->win < RAMAX)
+    ra->win *= 2;
+  else if(!miss && ra->win > RAMIN)
+    ra->win /= 2;
+
+  if(ra->next <= last)
+    ra->next = last + 1;
+  for(bn = ra->next; bn <= last + ra->win && bn < (ip->size + BSIZE - 1) / BSIZE; bn++){
+    if((addr = bmap(ip, bn, 1)) == 0)
+      break;
+    breadahead(ip->dev, addr);
+  }
+  ra->next = bn;
+  bkick();
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -510,11 +928,15 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(off + n > (uint64)MAXFILE*BSIZE)
     return -1;
 
+  // the file may be a program whose pages are cached by vma.c.
+  if(ip->textcached)
+    textdrop(ip);
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
+    uint addr = bmap(ip, off/BSIZE, (n - tot + BSIZE - 1) / BSIZE);
     if(addr == 0)
       break;
     bp = bread(ip->dev, addr);
@@ -523,7 +945,10 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
-    log_write(bp);
+    if(WBDATA(ip))
+      bdirty(bp, 0);
+    else
+      log_write(bp);
     brelse(bp);
   }
 
@@ -546,16 +971,182 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
-// Look for a directory entry in a directory.
-// If found, set *poff to byte offset of entry.
-struct inode*
-dirlookup(struct inode *dp, char *name, uint *poff)
+// Hashed directories; see DHASH in fs.h.
+
+static uint
+dhash(char *name)
 {
-  uint off, inum;
-  struct dirent de;
+  uint h = 2166136261;  // FNV-1a
+  int i;
 
-  if(dp->type != T_DIR)
-    panic("dirlookup not DIR");
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h % NDHASH;
+}
+
+// The block number kept in link entry de.
+static uint
+dgetlink(struct dirent *de)
+{
+  uint bn;
+
+  memmove(&bn, de->name, sizeof(bn));
+  return bn;
+}
+
+static void
+dsetlink(struct dirent *de, uint bn)
+{
+  memmove(de->name, &bn, sizeof(bn));
+}
+
+// Lock and return block bn of directory dp.
+static struct buf*
+dread(struct inode *dp, uint bn)
+{
+  uint addr;
+
+  if((addr = bmap(dp, bn, 1)) == 0)
+    panic("dread");
+  return bread(dp->dev, addr);
+}
+
+// Add a zeroed block to the end of directory dp.
+// Returns its number, or -1 if out of disk space.
+static int
+dgrow(struct inode *dp)
+{
+  uint bn = dp->size / BSIZE;
+
+  if(bmap(dp, bn, 1) == 0)
+    return -1;
+  dp->size += BSIZE;
+  iupdate(dp);
+  return bn;
+}
+
+// Search hashed directory dp for name: just name's chain.
+// Returns its inum and sets *poff, or returns 0.
+static uint
+hdirscan(struct inode *dp, char *name, uint *poff)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint bn, inum, off;
+  int i;
+
+  if(dp->size == 0)
+    return 0;
+  bp = dread(dp, 0);
+  de = (struct dirent*)bp->data;
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
+    i = namecmp(name, ".") == 0 ? 0 : 1;
+    inum = de[i].inum;
+    off = i * sizeof(*de);
+    brelse(bp);
+    if(inum == 0)
+      return 0;
+    goto found;
+  }
+  bn = dgetlink(&de[2 + dhash(name)]);
+  brelse(bp);
+
+  while(bn != 0){
+    bp = dread(dp, bn);
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < DPB - 1; i++){
+      if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+        inum = de[i].inum;
+        off = bn * BSIZE + i * sizeof(*de);
+        brelse(bp);
+        goto found;
+      }
+    }
+    bn = dgetlink(&de[DPB - 1]);
+    brelse(bp);
+  }
+  return 0;
+
+found:
+  if(poff)
+    *poff = off;
+  return inum;
+}
+
+// dirlink() for a hashed directory: use a free entry in
+// name's chain, or add a block to the end of the chain.
+static int
+hdirlink(struct inode *dp, char *name, uint inum)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint bn, prev, prevslot;
+  int i, nb;
+
+  // a new directory: make block 0.
+  if(dp->size == 0 && dgrow(dp) < 0)
+    return -1;
+
+  bp = dread(dp, 0);
+  de = (struct dirent*)bp->data;
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
+    i = namecmp(name, ".") == 0 ? 0 : 1;
+    strncpy(de[i].name, name, DIRSIZ);
+    de[i].inum = inum;
+    log_write(bp);
+    brelse(bp);
+    return 0;
+  }
+  prev = 0;
+  prevslot = 2 + dhash(name);
+  bn = dgetlink(&de[prevslot]);
+  brelse(bp);
+
+  while(bn != 0){
+    bp = dread(dp, bn);
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < DPB - 1; i++){
+      if(de[i].inum == 0){
+        strncpy(de[i].name, name, DIRSIZ);
+        de[i].inum = inum;
+        log_write(bp);
+        brelse(bp);
+        return 0;
+      }
+    }
+    prev = bn;
+    prevslot = DPB - 1;
+    bn = dgetlink(&de[DPB - 1]);
+    brelse(bp);
+  }
+
+  // the chain is full.
+  if((nb = dgrow(dp)) < 0)
+    return -1;
+  bn = nb;
+  bp = dread(dp, bn);
+  de = (struct dirent*)bp->data;
+  strncpy(de[0].name, name, DIRSIZ);
+  de[0].inum = inum;
+  log_write(bp);
+  brelse(bp);
+
+  bp = dread(dp, prev);
+  dsetlink(&((struct dirent*)bp->data)[prevslot], bn);
+  log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Search directory dp for name, from start to end.
+// Returns its inum and sets *poff, or returns 0.
+static uint
+dirscan(struct inode *dp, char *name, uint *poff)
+{
+  uint off;
+  struct dirent de;
 
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -566,14 +1157,36 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       // entry matches path element
       if(poff)
         *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+      return de.inum;
     }
   }
 
   return 0;
 }
 
+// Look for a directory entry in a directory.
+// If found, set *poff to byte offset of entry.
+// Callers that don't need the offset may get the
+// answer from the name cache (dcache.c).
+struct inode*
+dirlookup(struct inode *dp, char *name, uint *poff)
+{
+  uint inum;
+
+  if(dp->type != T_DIR)
+    panic("dirlookup not DIR");
+
+  if(poff == 0 && dcachelookup(dp->dev, dp->inum, name, &inum))
+    return inum ? iget(dp->dev, inum) : 0;
+
+  if(dp->major == DHASH)
+    inum = hdirscan(dp, name, poff);
+  else
+    inum = dirscan(dp, name, poff);
+  dcacheenter(dp->dev, dp->inum, name, inum);
+  return inum ? iget(dp->dev, inum) : 0;
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 // Returns 0 on success, -1 on failure (e.g. out of disk blocks).
 int
@@ -588,6 +1201,12 @@ dirlink(struct inode *dp, char *name, uint inum)
     iput(ip);
     return -1;
   }
+  if(dp->major == DHASH){
+    if(hdirlink(dp, name, inum) < 0)
+      return -1;
+    dcacheenter(dp->dev, dp->inum, name, inum);
+    return 0;
+  }
 
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
@@ -601,6 +1220,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcacheenter(dp->dev, dp->inum, name, inum);
 
   return 0;
 }
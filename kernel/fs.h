@@ -24,9 +24,25 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+// Most data blocks the log can hold: the log header
+// block lists them after a count.
+#define LOGMAX (BSIZE / sizeof(uint) - 1)
+
+#define NDIRECT 10
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
+
+// A T_FILE whose major is FEXTENT maps its blocks with extents,
+// runs of consecutive blocks, instead: addrs[] holds NEXTENT
+// (start, length) pairs, then the address of a block holding
+// NEXTENTBLK more. open(O_CREATE|O_EXTENT) makes such files;
+// they can't grow past NEXTENT+NEXTENTBLK runs, so on a
+// fragmented disk they stay far smaller than MAXFILE.
+#define FEXTENT 1
+#define NEXTENT ((NDIRECT + 2) / 2)
+#define NEXTENTBLK (BSIZE / (2 * sizeof(uint)))
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +51,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+3];   // Data block addresses
 };
 
 // Inodes per block.
@@ -58,3 +74,16 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Entries per directory block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A T_DIR whose major is DHASH keeps its entries in NDHASH
+// chains of blocks, picked by a hash of the name. Block 0
+// holds "." and "..", then the first block of each chain;
+// every other block holds DPB-1 entries and then the next
+// block of its chain. The block numbers are kept in the name
+// of entries with inum 0, which readers of the directory
+// skip, so it still reads as a list of dirents.
+#define DHASH 1
+#define NDHASH (DPB - 2)
+
@@ -0,0 +1,14 @@
+// istat.h - Inode table statistics, filled in by the istat() syscall
+// Shared between kernel and user space
+
+#ifndef _ISTAT_H_
+#define _ISTAT_H_
+
+struct istat {
+  uint ninode;     // entries in the inode table
+  uint inuse;      // entries with a nonzero reference count
+  uint hits;       // lookups that found the inode in the table
+  uint misses;     // lookups that recycled an entry for it
+};
+
+#endif // _ISTAT_H_
@@ -1,13 +1,19 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// and 2MB megapages from a pool at the top of RAM.
+// The pool isn't lost to kalloc(): once ordinary pages
+// run out, kalloc() splits megapages, and a split
+// megapage whose pages are all free again rejoins it.
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "proc.h"
 #include "defs.h"
+#include "memstat.h"
 
 void freerange(void *pa_start, void *pa_end);
 
@@ -18,16 +24,59 @@ struct run {
   struct run *next;
 };
 
+// index of the physical page pa in kmem.ref[].
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
+// the top NSUPERPAGE megapages of RAM are kept for superalloc().
+#define SUPERBASE (PHYSTOP - (uint64)NSUPERPAGE * SUPERPGSIZE)
+#define PA2SUPER(pa) (((uint64)(pa) - SUPERBASE) / SUPERPGSIZE)
+
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int nfree;  // pages on freelist
+
+  // free pages the zeroer thread has already filled
+  // with zeros, for kalloc_zeroed(). kalloc() takes
+  // them too once freelist is empty.
+  struct run *zerolist;
+  int nzero;     // pages on zerolist
+  uint zhits;    // kalloc_zeroed()s served from zerolist
+  uint zmisses;  // kalloc_zeroed()s that had to zero a page
+  uint zeroed;   // pages the zeroer has zeroed
+
+  // number of references to each physical page.
+  // a page can be mapped by several page tables
+  // (e.g. shared program text), and is only
+  // returned to the free list when the last
+  // reference is dropped with kfree().
+  int ref[(PHYSTOP - KERNBASE) / PGSIZE];
+
+  // free megapages. a megapage's reference count is
+  // that of its first page. once ksplit() has broken
+  // a megapage up, its pages are ordinary pages, except
+  // that when freed they go on its own spare list, and
+  // when all of them are there it is whole again.
+  struct run *superlist;
+  char split[NSUPERPAGE];
+  struct run *spare[NSUPERPAGE];
+  int nspare[NSUPERPAGE];
+  int nspares;   // pages on all spare lists
 } kmem;
 
+static void splitlocked(char *pa);
+
 void
 kinit()
 {
+  char *p;
+
   initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  freerange(end, (void*)SUPERBASE);
+  for(p = (char*)SUPERBASE; p < (char*)PHYSTOP; p += SUPERPGSIZE){
+    kmem.ref[PA2REF(p)] = 1;
+    kfree(p);
+  }
 }
 
 void
@@ -35,48 +84,306 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    kmem.ref[PA2REF(p)] = 1;
     kfree(p);
+  }
 }
 
-// Free the page of physical memory pointed at by pa,
+// Drop a reference to the page of physical memory pointed at by pa,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when its last reference goes away.
+// pa may also be a megapage returned by superalloc().
 void
 kfree(void *pa)
 {
   struct run *r;
+  int super, spare;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  acquire(&kmem.lock);
+  super = (uint64)pa >= SUPERBASE && !kmem.split[PA2SUPER(pa)];
+  spare = (uint64)pa >= SUPERBASE && kmem.split[PA2SUPER(pa)];
+  if(super && ((uint64)pa % SUPERPGSIZE) != 0)
+    panic("kfree: megapage");
+  if(kmem.ref[PA2REF(pa)] < 1)
+    panic("kfree: ref");
+  if(--kmem.ref[PA2REF(pa)] > 0){
+    release(&kmem.lock);
+    return;
+  }
+  release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
-  memset(pa, 1, PGSIZE);
+  memset(pa, 1, super ? SUPERPGSIZE : PGSIZE);
 
   r = (struct run*)pa;
 
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  if(super){
+    r->next = kmem.superlist;
+    kmem.superlist = r;
+  } else if(spare){
+    int i = PA2SUPER(pa);
+    r->next = kmem.spare[i];
+    kmem.spare[i] = r;
+    kmem.nspares++;
+    if(++kmem.nspare[i] == SUPERPGSIZE / PGSIZE){
+      // every page is free: rejoin the megapage.
+      r = (struct run*)(SUPERBASE + (uint64)i * SUPERPGSIZE);
+      kmem.spare[i] = 0;
+      kmem.nspare[i] = 0;
+      kmem.nspares -= SUPERPGSIZE / PGSIZE;
+      kmem.split[i] = 0;
+      r->next = kmem.superlist;
+      kmem.superlist = r;
+    }
+  } else {
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+    kmem.nfree++;
+  }
   release(&kmem.lock);
 }
 
+// Take a page from the spare list of a split megapage,
+// splitting a free megapage first if no split one has
+// any. Caller holds kmem.lock.
+static struct run *
+spareget(void)
+{
+  struct run *r;
+  int i;
+
+  for(i = 0; i < NSUPERPAGE; i++)
+    if(kmem.spare[i])
+      break;
+  if(i == NSUPERPAGE){
+    if((r = kmem.superlist) == 0)
+      return 0;
+    kmem.superlist = r->next;
+    splitlocked((char*)r);
+    i = PA2SUPER(r);
+  }
+  r = kmem.spare[i];
+  kmem.spare[i] = r->next;
+  kmem.nspare[i]--;
+  kmem.nspares--;
+  return r;
+}
+
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// When out of ordinary pages, uses megapages' memory,
+// and then takes some back from the buffer cache,
+// so must not be called holding bcache locks.
 void *
 kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  for(;;){
+    acquire(&kmem.lock);
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      kmem.nfree--;
+    } else if((r = kmem.zerolist) != 0){
+      kmem.zerolist = r->next;
+      kmem.nzero--;
+    } else {
+      r = spareget();
+    }
+    if(r)
+      kmem.ref[PA2REF(r)] = 1;
+    release(&kmem.lock);
+    if(r || bshrink() == 0)
+      break;
+  }
 
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
   return (void*)r;
 }
+
+// Allocate one 4096-byte page of physical memory, filled
+// with zeros. Takes one the zeroer has prepared if there is
+// one, and otherwise zeros a page from kalloc().
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = kmem.zerolist;
+  if(r){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+    kmem.ref[PA2REF(r)] = 1;
+    kmem.zhits++;
+  } else {
+    kmem.zmisses++;
+  }
+  release(&kmem.lock);
+
+  if(r){
+    r->next = 0;  // the only word that isn't zero
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// The zeroer kernel thread. Once a tick, moves pages from the
+// free list to zerolist, zeroing them, until there are
+// NZEROPAGE there. It runs in the lowest MLFQ queue, so that
+// it mostly uses time no one else wants.
+void
+kzeroer(void)
+{
+  struct run *r;
+  uint t0;
+
+  for(;;){
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < 1)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    for(;;){
+      acquire(&kmem.lock);
+      r = 0;
+      if(kmem.nzero < NZEROPAGE && (r = kmem.freelist) != 0){
+        kmem.freelist = r->next;
+        kmem.nfree--;
+      }
+      release(&kmem.lock);
+      if(r == 0)
+        break;
+
+      memset((char*)r, 0, PGSIZE);
+
+      acquire(&kmem.lock);
+      r->next = kmem.zerolist;
+      kmem.zerolist = r;
+      kmem.nzero++;
+      kmem.zeroed++;
+      release(&kmem.lock);
+    }
+  }
+}
+
+// Allocate one 2MB megapage of physical memory, aligned
+// to 2MB. Returns 0 if there are none left; callers fall
+// back to kalloc(). Unlike kalloc(), doesn't fill the
+// page with junk, since callers overwrite all of it.
+void *
+superalloc(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = kmem.superlist;
+  if(r){
+    kmem.superlist = r->next;
+    kmem.ref[PA2REF(r)] = 1;
+  }
+  release(&kmem.lock);
+  return (void*)r;
+}
+
+// Turn the megapage pa, which must have just one
+// reference, into 512 ordinary pages, each of which
+// must then be freed separately with kfree().
+void
+ksplit(void *pa)
+{
+  acquire(&kmem.lock);
+  if((uint64)pa < SUPERBASE || ((uint64)pa % SUPERPGSIZE) != 0 ||
+     kmem.split[PA2SUPER(pa)] || kmem.ref[PA2REF(pa)] != 1)
+    panic("ksplit");
+  kmem.split[PA2SUPER(pa)] = 1;
+  for(int i = 0; i < SUPERPGSIZE / PGSIZE; i++)
+    kmem.ref[PA2REF(pa) + i] = 1;
+  release(&kmem.lock);
+}
+
+// Split the free megapage pa for kalloc(), putting all
+// its pages on its spare list. Caller holds kmem.lock.
+static void
+splitlocked(char *pa)
+{
+  int i = PA2SUPER(pa);
+  struct run *r;
+
+  kmem.split[i] = 1;
+  for(char *p = pa; p < pa + SUPERPGSIZE; p += PGSIZE){
+    kmem.ref[PA2REF(p)] = 0;
+    r = (struct run*)p;
+    r->next = kmem.spare[i];
+    kmem.spare[i] = r;
+  }
+  kmem.nspare[i] = SUPERPGSIZE / PGSIZE;
+  kmem.nspares += SUPERPGSIZE / PGSIZE;
+}
+
+// Add a reference to a page returned by kalloc(),
+// so that it survives one more kfree().
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2REF(pa)] < 1)
+    panic("kdup: ref");
+  kmem.ref[PA2REF(pa)]++;
+  release(&kmem.lock);
+}
+
+// Return the number of free pages, not counting whole megapages.
+// Only a hint, since it may change as soon as it's read.
+int
+kfreepages(void)
+{
+  return kmem.nfree + kmem.nzero + kmem.nspares;
+}
+
+// Copy the allocator's counters to user address addr.
+int
+memstat(uint64 addr)
+{
+  struct memstat st;
+
+  acquire(&kmem.lock);
+  st.nfree = kmem.nfree;
+  st.nzero = kmem.nzero;
+  st.zhits = kmem.zhits;
+  st.zmisses = kmem.zmisses;
+  st.zeroed = kmem.zeroed;
+  release(&kmem.lock);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+// Return the number of references to page pa.
+int
+krefcnt(void *pa)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.ref[PA2REF(pa)];
+  release(&kmem.lock);
+  return n;
+}
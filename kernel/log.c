@@ -21,6 +21,19 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// Group commit: a transaction stays open for GROUPTICKS
+// ticks after its first write, so the system calls of that
+// window, even ones that don't overlap, share one commit,
+// and repeated writes to a block are absorbed into one log
+// slot. The last end_op() after the window commits, or the
+// logger thread does if the system has gone quiet. Until
+// then a finished system call's updates are not yet durable.
+//
+// Committed blocks are installed to their home locations
+// (checkpointed) only when the log gets full, or by the
+// logger once nothing is happening; until then they stay
+// in the log, and later transactions are appended after them.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
@@ -28,57 +41,119 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// A block may appear more than once, if it was written by
+// several committed transactions; the last copy wins.
+//
+// In write-back mode file data doesn't go through the log; see
+// bdirty() in bio.c. commit() writes newly allocated data blocks
+// before the transaction that allocates them, and fsync() writes
+// the rest of the dirty data and then empties the log, so that
+// recovery can't replace what it wrote with an older logged copy.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  int block[LOGMAX];
 };
 
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // log blocks on disk, including the header block
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks they may still write.
   int committing;  // in commit(), please wait.
+  int syncing;     // log_sync() is waiting to commit, please wait.
+  int committed;   // lh.block[0..committed) are committed, not yet installed.
+  uint opened;     // ticks when the open transaction first wrote.
   int dev;
   struct logheader lh;
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void commit(int);
+static void logger(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
+  if (sb->nlog - 1 > LOGMAX || sb->nlog - 1 < MAXOPBLOCKS)
+    panic("initlog: bad log size");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
   recover_from_log();
+  kthread("logger", logger, KTHREADPRIO);
+}
+
+// Is lh.block[i] logged again later?
+static int
+relogged(int i)
+{
+  int j;
+
+  for (j = i + 1; j < log.lh.n; j++)
+    if (log.lh.block[j] == log.lh.block[i])
+      return 1;
+  return 0;
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// A block logged more than once is installed just once, from
+// its last copy. Outside of recovery the cached copy of each
+// block is pinned and already up to date, so the log is not
+// read back.
+// Up to LOGBATCH writes are in flight at once.
 static void
 install_trans(int recovering)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  struct buf *dbuf[LOGBATCH];
+  struct buf *b;
+  int tail, i, n, m;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if(n > LOGBATCH)
+      n = LOGBATCH;
+    if(recovering){
+      for (i = 0; i < n; i++)
+        breadahead(log.dev, log.start+tail+i+1);
+    }
+    m = 0;
+    for (i = 0; i < n; i++) {
+      if(relogged(tail+i)){
+        // a later copy will be installed.
+        if(recovering == 0){
+          b = bread(log.dev, log.lh.block[tail+i]);
+          bunpin(b);
+          brelse(b);
+        }
+        continue;
+      }
+      dbuf[m] = bread(log.dev, log.lh.block[tail+i]); // read dst
+      if(recovering){
+        b = bread(log.dev, log.start+tail+i+1); // read log block
+        memmove(dbuf[m]->data, b->data, BSIZE);  // copy block to dst
+        brelse(b);
+      }
+      m++;
+    }
+    // start the writes together, so the disk driver can
+    // merge adjacent ones.
+    for (i = 0; i < m; i++)
+      bwritestart(dbuf[i]);  // write dst to disk
+    for (i = 0; i < m; i++) {
+      bwait(dbuf[i]);
+      if(recovering == 0)
+        bunpin(dbuf[i]);
+      brelse(dbuf[i]);
+    }
   }
 }
 
@@ -98,7 +173,7 @@ read_head(void)
 
 // Write in-memory log header to disk.
 // This is the true point at which the
-// current transaction commits.
+// open transaction commits.
 static void
 write_head(void)
 {
@@ -122,39 +197,79 @@ recover_from_log(void)
   write_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// Commit, and maybe install, with log.lock held, no FS system
+// calls outstanding, and no one else committing. Releases
+// log.lock while writing to the disk.
+static void
+docommit(int checkpoint)
+{
+  log.committing = 1;
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  release(&log.lock);
+  commit(checkpoint);
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+}
+
+// The most blocks one FS operation may reserve with
+// begin_opn(): a quarter of the log, so that several
+// big writes can share a transaction.
+int
+log_maxop(void)
+{
+  int n = (log.size - 1) / 4;
+
+  return n > MAXOPBLOCKS ? n : MAXOPBLOCKS;
+}
+
+// called at the start of each FS system call,
+// which may write up to nblocks blocks.
 void
-begin_op(void)
+begin_opn(int nblocks)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
-      sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    if(log.committing || log.syncing){
       sleep(&log, &log.lock);
+    } else if(log.lh.n + log.reserved + nblocks > log.size - 1){
+      // this op might exhaust log space; wait for commit,
+      // or empty the log now if no one else is left to.
+      if(log.outstanding == 0)
+        docommit(1);
+      else
+        sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += nblocks;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
 void
-end_op(void)
+begin_op(void)
 {
-  int do_commit = 0;
+  begin_opn(MAXOPBLOCKS);
+}
 
+// called at the end of each FS system call, with the
+// nblocks it passed to begin_opn().
+// commits if this was the last outstanding operation
+// and the open transaction's window has passed.
+void
+end_opn(int nblocks)
+{
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= nblocks;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(log.outstanding == 0 && log.lh.n > log.committed &&
+     ticks - log.opened >= GROUPTICKS){
+    docommit(0);
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -162,43 +277,115 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
+
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// Commit the open transaction and install the log, once
+// the FS system calls in progress have finished, holding
+// off new ones.
+void
+log_sync(void)
+{
+  acquire(&log.lock);
+  log.syncing++;
+  while(log.committing || log.outstanding > 0)
+    sleep(&log, &log.lock);
+  docommit(1);
+  log.syncing--;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Is block blockno in the log, committed or not?
+int
+log_holds(uint blockno)
+{
+  int i, r = 0;
+
+  acquire(&log.lock);
+  for (i = 0; i < log.lh.n && !r; i++)
+    r = log.lh.block[i] == blockno;
+  release(&log.lock);
+  return r;
+}
+
+// The logger kernel thread. Once a tick, commits an open
+// transaction whose window has passed if no system call
+// is around to do it, and installs the log once nothing
+// has been written to it for a tick.
+static void
+logger(void)
+{
+  uint t0;
+
+  for(;;){
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < 1)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
     acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+    if(log.outstanding == 0 && !log.committing){
+      if(log.lh.n > log.committed){
+        if(ticks - log.opened >= GROUPTICKS)
+          docommit(0);
+      } else if(log.lh.n > 0){
+        docommit(1);
+      }
+    }
     release(&log.lock);
   }
 }
 
 // Copy modified blocks from cache to log.
+// Up to LOGBATCH writes are in flight at once.
 static void
 write_log(void)
 {
-  int tail;
+  struct buf *to[LOGBATCH];
+  int tail, i, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (tail = log.committed; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if(n > LOGBATCH)
+      n = LOGBATCH;
+    for (i = 0; i < n; i++) {
+      to[i] = bread(log.dev, log.start+tail+i+1); // log block
+      struct buf *from = bread(log.dev, log.lh.block[tail+i]); // cache block
+      memmove(to[i]->data, from->data, BSIZE);
+      brelse(from);
+    }
+    for (i = 0; i < n; i++)
+      bwritestart(to[i]);  // write the log, as one disk request
+    for (i = 0; i < n; i++) {
+      bwait(to[i]);
+      brelse(to[i]);
+    }
   }
 }
 
+// Commit the open transaction, if any. Then, if checkpoint
+// is set, install everything in the log and empty it.
 static void
-commit()
+commit(int checkpoint)
 {
-  if (log.lh.n > 0) {
+  if (log.lh.n > log.committed) {
+    bflush(0);       // Write newly allocated file data blocks
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
+    log.committed = log.lh.n;
+  }
+  if (checkpoint && log.lh.n > 0) {
     install_trans(0); // Now install writes to home locations
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.committed = 0;
+    write_head();    // Erase the transactions from the log
   }
 }
 
@@ -217,17 +404,21 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.size - 1)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
-  for (i = 0; i < log.lh.n; i++) {
+  // committed copies must stay as they are until installed,
+  // so only the open transaction's blocks can absorb this one.
+  for (i = log.committed; i < log.lh.n; i++) {
     if (log.lh.block[i] == b->blockno)   // log absorption
       break;
   }
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
+    if (i == log.committed)  // first write of the transaction
+      log.opened = ticks;
     bpin(b);
     log.lh.n++;
   }
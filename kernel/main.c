@@ -19,6 +19,8 @@ main()
     kinit();         // physical page allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    asidinit();      // address-space IDs
+    vmainit();       // shared program text cache
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
@@ -26,9 +28,12 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
+    dcacheinit();    // name cache
     fileinit();      // file table
+    pollinit();      // poll() wait queues
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
+    kthread("zeroer", kzeroer, NMLFQ-1); // pre-zeroes free pages when idle
     __sync_synchronize();
     started = 1;
   } else {
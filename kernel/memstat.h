@@ -0,0 +1,15 @@
+// memstat.h - Page allocator statistics, filled in by the memstat() syscall
+// Shared between kernel and user space
+
+#ifndef _MEMSTAT_H_
+#define _MEMSTAT_H_
+
+struct memstat {
+  uint nfree;      // free pages not yet zeroed
+  uint nzero;      // free pages the zeroer has zeroed
+  uint zhits;      // kalloc_zeroed()s that found a zeroed page
+  uint zmisses;    // kalloc_zeroed()s that had to zero one
+  uint zeroed;     // pages the zeroer has zeroed in all
+};
+
+#endif // _MEMSTAT_H_
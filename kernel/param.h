@@ -1,16 +1,35 @@
-#define NPROC        64  // maximum number of processes
+#ifndef NPROC
+#define NPROC        64  // maximum number of processes; make NPROC=n overrides
+#endif
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define PIPEPAGES     4  // pages in a pipe's buffer; must be a power of two
+#define NINODE      512  // i-nodes cached in memory, in use or not
+#define NDENTRY     512  // names remembered by the name cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define LOGSIZE      128   // default on-disk log blocks; mkfs -l overrides
+#define NBUF         (MAXOPBLOCKS*3)  // initial size of disk block cache
+#define NBUFMAX      2048  // most blocks the disk block cache grows to
+#define BUFRESERVE   1024  // free pages below which it stops growing
+#define RAMIN        4     // initial sequential readahead window, in blocks
+#define RAMAX        32    // largest readahead window
+#define LOGBATCH     16    // log writes in flight at once
+#define GROUPTICKS   1     // ticks a transaction stays open for group commit
+#define WRITEBACK    1     // 1: file data is written back from the cache, not logged
+#define FLUSHTICKS   10    // ticks dirty file data may wait for the flusher
+#define FLUSHBATCH   32    // dirty blocks the flusher writes at once
+#define FSSIZE       40000 // size of file system in blocks
+#define NBMAP        64    // most free map blocks fs.c keeps counts for
+#define NIBLOCK      1024  // most inode blocks fs.c keeps counts for
 #define MAXPATH      128   // maximum file path name
+#define NVMA         16    // lazily mapped regions per process
+#define NTEXTPAGE    64    // shared read-only program pages cached by vma.c
+#define NSUPERPAGE   8     // 2MB pages kept whole for large user allocations, while kalloc() can spare them
+#define NZEROPAGE    256   // free pages the zeroer keeps zeroed for kalloc_zeroed()
 
 // MLFQ Scheduler parameters
 #define NMLFQ        3     // number of priority queues (0=highest, 2=lowest)
@@ -18,3 +37,4 @@
 #define MLFQ_TICKS_1 2     // time slice for queue 1 (medium priority)
 #define MLFQ_TICKS_2 4     // time slice for queue 2 (lowest priority)
 #define BOOST_INTERVAL 100 // ticks before priority boost (anti-starvation)
+#define KTHREADPRIO  1     // fixed queue of the kernel's own threads
@@ -7,18 +7,48 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
 
-#define PIPESIZE 512
+#define PIPESIZE (PIPEPAGES * PGSIZE)
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
+// The ring buffer is kept as separate pages, and data is
+// copied in and out up to a page at a time. A writer only
+// wakes readers when it makes an empty pipe non-empty, and
+// a reader only wakes writers when it makes a full one
+// non-full, since no one sleeps otherwise.
+//
+// splice() copies between the pages and a file, which may
+// sleep, so it can't hold pi->lock while it does; instead it
+// claims an end of the pipe with rbusy or wbusy, and everyone
+// else leaves that end's counter alone until it's done.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEPAGES]; // byte i is at page[i/PGSIZE][i%PGSIZE]
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rbusy;      // a splice() is reading
+  int wbusy;      // a splice() is writing
+  struct pollq pollq; // poll()s waiting for either end
 };
 
+// Where byte i of pi's stream is, and how much of the
+// stream can follow it on the same page.
+#define PIPEBYTE(pi, i) ((pi)->page[(i) % PIPESIZE / PGSIZE] + (i) % PGSIZE)
+#define PAGEREST(i) (PGSIZE - (i) % PGSIZE)
+
+static void
+pipefree(struct pipe *pi)
+{
+  for(int i = 0; i < PIPEPAGES; i++){
+    if(pi->page[i])
+      kfree(pi->page[i]);
+  }
+  kfree((char*)pi);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,10 +60,19 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  for(int i = 0; i < PIPEPAGES; i++)
+    pi->page[i] = 0;
+  for(int i = 0; i < PIPEPAGES; i++){
+    if((pi->page[i] = kalloc()) == 0)
+      goto bad;
+  }
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->rbusy = 0;
+  pi->wbusy = 0;
+  pi->pollq.head = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,7 +86,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    pipefree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -66,9 +105,10 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  pollwake(&pi->pollq);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
@@ -77,6 +117,7 @@ int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
   int i = 0;
+  uint m;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -86,17 +127,23 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       return -1;
     }
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
+    } else if(pi->wbusy){
+      sleep(&pi->wbusy, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      // as much as fits, up to the end of the page.
+      m = min(n - i, PIPESIZE - (pi->nwrite - pi->nread));
+      m = min(m, PAGEREST(pi->nwrite));
+      if(copyin(pr->pagetable, PIPEBYTE(pi, pi->nwrite), addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      if(pi->nwrite == pi->nread){
+        wakeup(&pi->nread);
+        pollwake(&pi->pollq);
+      }
+      pi->nwrite += m;
+      i += m;
     }
   }
-  wakeup(&pi->nread);
   release(&pi->lock);
 
   return i;
@@ -106,25 +153,220 @@ int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
   int i;
+  uint m;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while((pi->nread == pi->nwrite && pi->writeopen) || pi->rbusy){  //DOC: pipe-empty
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
-    sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    sleep(pi->rbusy ? (void*)&pi->rbusy : (void*)&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    m = min(n - i, pi->nwrite - pi->nread);
+    m = min(m, PAGEREST(pi->nread));
+    if(copyout(pr->pagetable, addr + i, PIPEBYTE(pi, pi->nread), m) == -1)
       break;
+    if(pi->nwrite == pi->nread + PIPESIZE){
+      wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+      pollwake(&pi->pollq);
+    }
+    pi->nread += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+// For poll(): which of POLLIN, POLLOUT, POLLHUP (no writer
+// left) and POLLERR (no reader left) hold for pi. Puts e, if
+// not 0, on pi's poll queue.
+int
+pipepoll(struct pipe *pi, struct pollent *e)
+{
+  int r = 0;
+
+  acquire(&pi->lock);
+  if(pi->nread != pi->nwrite)
+    r |= POLLIN;
+  if(pi->nwrite != pi->nread + PIPESIZE)
+    r |= POLLOUT;
+  if(pi->writeopen == 0)
+    r |= POLLHUP;
+  if(pi->readopen == 0)
+    r |= POLLERR;
+  pollregister(&pi->pollq, e);
+  release(&pi->lock);
+  return r;
+}
+
+// Claim an end of pi, *busy being pi->rbusy or pi->wbusy.
+static void
+pipeclaim(struct pipe *pi, int *busy)
+{
+  acquire(&pi->lock);
+  while(*busy)
+    sleep(busy, &pi->lock);
+  *busy = 1;
+  release(&pi->lock);
+}
+
+static void
+pipeunclaim(struct pipe *pi, int *busy)
+{
+  acquire(&pi->lock);
+  *busy = 0;
+  wakeup(busy);
+  release(&pi->lock);
+}
+
+// Wait until pi has data, or no writer. Returns how many
+// bytes it has, or -1 if killed. Caller holds pi->lock.
+static int
+pipewaitdata(struct pipe *pi)
+{
+  while(pi->nread == pi->nwrite && pi->writeopen){
+    if(killed(myproc()))
+      return -1;
+    sleep(&pi->nread, &pi->lock);
+  }
+  return pi->nwrite - pi->nread;
+}
+
+// Wait until pi has room. Returns how many bytes, or -1
+// if killed or there's no reader. Caller holds pi->lock.
+static int
+pipewaitroom(struct pipe *pi)
+{
+  while(pi->nwrite == pi->nread + PIPESIZE && pi->readopen){
+    if(killed(myproc()))
+      return -1;
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  if(pi->readopen == 0 || killed(myproc()))
+    return -1;
+  return PIPESIZE - (pi->nwrite - pi->nread);
+}
+
+// Add m bytes, written to the pipe's pages, to pi's stream.
+static void
+pipeput(struct pipe *pi, int m)
+{
+  acquire(&pi->lock);
+  if(pi->nwrite == pi->nread){
+    wakeup(&pi->nread);
+    pollwake(&pi->pollq);
+  }
+  pi->nwrite += m;
+  release(&pi->lock);
+}
+
+// Drop m bytes, copied out of the pipe's pages, from pi's stream.
+static void
+pipeget(struct pipe *pi, int m)
+{
+  acquire(&pi->lock);
+  if(pi->nwrite == pi->nread + PIPESIZE){
+    wakeup(&pi->nwrite);
+    pollwake(&pi->pollq);
+  }
+  pi->nread += m;
+  release(&pi->lock);
+}
+
+// splice() from file f into pi: read up to n bytes of f
+// straight into the pipe's pages, until the end of f.
+int
+splicein(struct pipe *pi, struct file *f, int n)
+{
+  int tot = 0, m, r = 0;
+
+  pipeclaim(pi, &pi->wbusy);
+  while(tot < n){
+    acquire(&pi->lock);
+    m = pipewaitroom(pi);
+    release(&pi->lock);
+    if(m < 0){
+      r = -1;
+      break;
+    }
+    m = min(n - tot, min(m, PAGEREST(pi->nwrite)));
+    if((r = filereadk(f, PIPEBYTE(pi, pi->nwrite), m)) <= 0)
+      break;
+    pipeput(pi, r);
+    tot += r;
+    if(r < m)
+      break;
+  }
+  pipeunclaim(pi, &pi->wbusy);
+  return tot > 0 || r >= 0 ? tot : -1;
+}
+
+// splice() from pi into file f: wait for data, like
+// piperead(), then write what's there, up to n bytes,
+// from the pipe's pages to f.
+int
+spliceout(struct pipe *pi, struct file *f, int n)
+{
+  int tot = 0, m, r = 0;
+
+  pipeclaim(pi, &pi->rbusy);
+  acquire(&pi->lock);
+  r = pipewaitdata(pi);
+  release(&pi->lock);
+  while(r > 0 && tot < n){
+    acquire(&pi->lock);
+    m = pi->nwrite - pi->nread;
+    release(&pi->lock);
+    if(m == 0)
+      break;
+    m = min(n - tot, min(m, PAGEREST(pi->nread)));
+    if((r = filewritek(f, PIPEBYTE(pi, pi->nread), m)) <= 0)
+      break;
+    pipeget(pi, r);
+    tot += r;
+  }
+  pipeunclaim(pi, &pi->rbusy);
+  return tot > 0 || r >= 0 ? tot : -1;
+}
+
+// splice() from pipe in to pipe out: wait for data, like
+// piperead(), then copy what's there, up to n bytes, from
+// in's pages to out's, waiting for room in out.
+int
+splicepipe(struct pipe *in, struct pipe *out, int n)
+{
+  int tot = 0, m, room, r;
+
+  if(in == out)
+    return -1;
+  pipeclaim(in, &in->rbusy);
+  pipeclaim(out, &out->wbusy);
+  acquire(&in->lock);
+  r = pipewaitdata(in);
+  release(&in->lock);
+  while(r > 0 && tot < n){
+    acquire(&in->lock);
+    m = in->nwrite - in->nread;
+    release(&in->lock);
+    if(m == 0)
+      break;
+    acquire(&out->lock);
+    room = pipewaitroom(out);
+    release(&out->lock);
+    if(room < 0){
+      r = -1;
+      break;
+    }
+    m = min(min(n - tot, m), min(room, PAGEREST(in->nread)));
+    m = min(m, PAGEREST(out->nwrite));
+    memmove(PIPEBYTE(out, out->nwrite), PIPEBYTE(in, in->nread), m);
+    pipeput(out, m);
+    pipeget(in, m);
+    tot += m;
+  }
+  pipeunclaim(out, &out->wbusy);
+  pipeunclaim(in, &in->rbusy);
+  return tot > 0 || r >= 0 ? tot : -1;
+}
@@ -0,0 +1,157 @@
+//
+// poll(): wait until any of several files is ready.
+//
+// Each object a process can wait for (a pipe, the console)
+// has a pollq of the poll()s waiting for it. poll() puts a
+// pollent for each of its files on that file's queue, checks
+// them all, and sleeps until pollwake() is called on one of
+// the queues, which the object does, holding its own lock,
+// whenever it wakes its readers or writers.
+//
+// Lock order: the object's lock, then polllock.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "poll.h"
+#include "defs.h"
+
+struct spinlock polllock;
+
+// poll()s with a timeout, woken every tick.
+static struct pollq tickq;
+
+void
+pollinit(void)
+{
+  initlock(&polllock, "poll");
+}
+
+// Put e on q, if e isn't 0. Caller holds the lock
+// of the object q belongs to.
+void
+pollregister(struct pollq *q, struct pollent *e)
+{
+  if(e == 0)
+    return;
+  acquire(&polllock);
+  e->q = q;
+  e->next = q->head;
+  q->head = e;
+  release(&polllock);
+}
+
+// Take e off the queue it's on, if any.
+static void
+pollunregister(struct pollent *e)
+{
+  struct pollent **pe;
+
+  if(e->q == 0)
+    return;
+  acquire(&polllock);
+  for(pe = &e->q->head; *pe != e; pe = &(*pe)->next)
+    ;
+  *pe = e->next;
+  release(&polllock);
+  e->q = 0;
+}
+
+// Wake the poll()s waiting on q. Caller holds the lock of
+// the object q belongs to, as pollregister()'s callers do,
+// so an empty q can be passed over without polllock.
+void
+pollwake(struct pollq *q)
+{
+  struct pollent *e;
+
+  if(q->head == 0)
+    return;
+  acquire(&polllock);
+  for(e = q->head; e; e = e->next){
+    if(!e->w->fired){
+      e->w->fired = 1;
+      wakeup(e->w);
+    }
+  }
+  release(&polllock);
+}
+
+// Called by clockintr() every tick. A poll() that joins
+// tickq just as this looks at it waits a tick longer.
+void
+polltick(void)
+{
+  pollwake(&tickq);
+}
+
+// Wait until one of the nfds struct pollfds in the user
+// array at addr is ready for its events, or for timeout
+// ticks (for ever, if timeout is negative). Fills in
+// revents and returns how many are ready.
+int
+poll(uint64 addr, int nfds, int timeout)
+{
+  struct pollfd fds[NOFILE];
+  struct pollent ent[NOFILE+1];
+  struct pollwait w;
+  struct proc *p = myproc();
+  struct file *f;
+  int i, n, first;
+  uint t0 = ticks;
+
+  if(nfds < 0 || nfds > NOFILE)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, addr, nfds * sizeof(fds[0])) < 0)
+    return -1;
+
+  for(i = 0; i <= nfds; i++){
+    ent[i].w = &w;
+    ent[i].q = 0;
+  }
+  if(timeout > 0)
+    pollregister(&tickq, &ent[nfds]);
+
+  for(first = 1; ; first = 0){
+    acquire(&polllock);
+    w.fired = 0;
+    release(&polllock);
+
+    // join the files' queues the first time round.
+    n = 0;
+    for(i = 0; i < nfds; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if(fds[i].fd >= NOFILE || (f = p->ofile[fds[i].fd]) == 0)
+        fds[i].revents = POLLNVAL;
+      else
+        fds[i].revents = filepoll(f, first ? &ent[i] : 0) &
+                         (fds[i].events | POLLERR | POLLHUP);
+      if(fds[i].revents)
+        n++;
+    }
+    if(n > 0 || timeout == 0 || killed(p) ||
+       (timeout > 0 && ticks - t0 >= timeout))
+      break;
+
+    acquire(&polllock);
+    while(!w.fired && !killed(p))
+      sleep(&w, &polllock);
+    release(&polllock);
+  }
+
+  for(i = 0; i <= nfds; i++)
+    pollunregister(&ent[i]);
+  if(killed(p))
+    return -1;
+  if(copyout(p->pagetable, addr, (char*)fds, nfds * sizeof(fds[0])) < 0)
+    return -1;
+  return n;
+}
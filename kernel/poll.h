@@ -0,0 +1,19 @@
+// poll.h - Descriptors and events for the poll() syscall
+// Shared between kernel and user space
+
+#ifndef _POLL_H_
+#define _POLL_H_
+
+struct pollfd {
+  int   fd;        // file descriptor, or negative to skip
+  short events;    // POLLIN and/or POLLOUT
+  short revents;   // filled in by poll()
+};
+
+#define POLLIN   0x01  // read() won't block
+#define POLLOUT  0x04  // write() won't block
+#define POLLERR  0x08  // pipe has no reader left (always reported)
+#define POLLHUP  0x10  // pipe has no writer left (always reported)
+#define POLLNVAL 0x20  // fd isn't open (always reported)
+
+#endif // _POLL_H_
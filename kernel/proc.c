@@ -11,6 +11,19 @@ struct cpu cpus[NCPU];
 
 struct proc proc[NPROC];
 
+// Sleeping processes, hashed by channel, so that wakeup()
+// looks only at processes sleeping on channels that share
+// a queue with its own, not at all of proc[].
+#define NSLEEPQ 61
+#define SLEEPHASH(chan) (((uint64)(chan) >> 3) % NSLEEPQ)
+
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+  uint wakeups;    // wakeup() calls on this queue
+  uint looks;      // processes those calls examined
+} sleepq[NSLEEPQ];
+
 struct proc *initproc;
 
 int nextpid = 1;
@@ -23,6 +36,7 @@ int last_boost_tick = 0;         // Tick when last priority boost occurred
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void kthreadret(void);
 
 extern char trampoline[]; // trampoline.S
 
@@ -58,6 +72,8 @@ procinit(void)
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
   initlock(&mlfq_lock, "mlfq");  // Initialize MLFQ lock
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -111,10 +127,12 @@ allocpid()
 
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
-// and return with p->lock held.
+// and return with p->lock held. If kfn isn't 0, the proc is
+// a kernel thread that will run kfn(), and gets no trapframe
+// or user page table, since it never goes to user space.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(void (*kfn)(void))
 {
   struct proc *p;
 
@@ -132,27 +150,33 @@ found:
   p->pid = allocpid();
   p->state = USED;
 
-  // Allocate a trapframe page.
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
-  }
-
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
-  }
-
-  // Set up new context to start executing at forkret,
-  // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
-  p->context.ra = (uint64)forkret;
   p->context.sp = p->kstack + PGSIZE;
 
+  if(kfn){
+    // Start executing at kthreadret, which calls kfn.
+    p->kfn = kfn;
+    p->context.ra = (uint64)kthreadret;
+  } else {
+    // Allocate a trapframe page.
+    if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+
+    // An empty user page table.
+    p->pagetable = proc_pagetable(p);
+    if(p->pagetable == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+
+    // Start executing at forkret, which returns to user space.
+    p->context.ra = (uint64)forkret;
+  }
+
   // Initialize MLFQ fields - new process starts at highest priority
   p->priority = 0;
   p->ticks_used = 0;
@@ -177,6 +201,7 @@ freeproc(struct proc *p)
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
+  p->asidgen = 0;
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
@@ -184,6 +209,7 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->kfn = 0;
   p->state = UNUSED;
   // Reset MLFQ fields
   p->priority = 0;
@@ -258,7 +284,7 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy initcode's instructions
@@ -288,11 +314,14 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
+    if(sz + n > mmapbase(p))
+      return -1;
     if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
       return -1;
     }
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    p->asidgen = 0; // the TLB may hold the freed pages; see vm.c.
   }
   p->sz = sz;
   return 0;
@@ -307,8 +336,12 @@ fork(void)
   struct proc *np;
   struct proc *p = myproc();
 
+  // MAP_SHARED pages must exist before they can be shared.
+  if(vmashare(p) < 0)
+    return -1;
+
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
 
@@ -318,6 +351,11 @@ fork(void)
     release(&np->lock);
     return -1;
   }
+  if(vmadup(np, p) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
   np->sz = p->sz;
 
   // copy saved user registers.
@@ -389,6 +427,8 @@ exit(int status)
   end_op();
   p->cwd = 0;
 
+  vmaput(p->pagetable, p->vma);
+
   acquire(&wait_lock);
 
   // Give any children to init.
@@ -480,6 +520,7 @@ get_time_slice(int priority)
 
 // Priority boost: move all processes to highest priority queue
 // Called periodically to prevent starvation
+// Kernel threads keep their fixed priority
 static void
 priority_boost(void)
 {
@@ -492,7 +533,7 @@ priority_boost(void)
   
   for(p = proc; p < &proc[NPROC]; p++) {
     acquire(&p->lock);
-    if(p->state != UNUSED) {
+    if(p->state != UNUSED && p->kfn == 0) {
       if(p->priority > 0) {
         p->num_boosted++;   // Track boost only if actually moved up
       }
@@ -598,8 +639,9 @@ yield(void)
   // Check if process has used up its time slice
   // NOTE: ticks_used is incremented in mlfq_check_timer() (trap.c) 
   // ONLY on timer interrupts, not on voluntary yields
+  // Kernel threads stay in the queue they were given
   int time_slice = get_time_slice(p->priority);
-  if(p->ticks_used >= time_slice) {
+  if(p->ticks_used >= time_slice && p->kfn == 0) {
     // Demote to lower priority queue (if not already at lowest)
     if(p->priority < NMLFQ - 1) {
       p->priority++;
@@ -613,6 +655,38 @@ yield(void)
   release(&p->lock);
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  myproc()->kfn();
+  panic("kthread returned");
+}
+
+// Start a kernel thread: a process that runs fn() in the
+// kernel and never returns to user space. fn must not return,
+// and kill() refuses kernel threads, so fn needn't check killed().
+// The scheduler keeps it in MLFQ queue priority: it is neither
+// demoted nor boosted, though setprocpriority() can move it.
+void
+kthread(char *name, void (*fn)(void), int priority)
+{
+  struct proc *p;
+
+  if(priority < 0 || priority >= NMLFQ)
+    panic("kthread: priority");
+  if((p = allocproc(fn)) == 0)
+    panic("kthread");
+  p->priority = priority;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
@@ -637,6 +711,19 @@ forkret(void)
   usertrapret();
 }
 
+// Take p off its sleep queue. Caller holds p->sq->lock.
+static void
+sqremove(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &p->sq->head; *pp != p; pp = &(*pp)->qnext)
+    ;
+  *pp = p->qnext;
+  p->sq = 0;
+  p->qnext = 0;
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 // MLFQ: Process going to sleep is likely I/O-bound, reset ticks
@@ -644,15 +731,17 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *sq = &sleepq[SLEEPHASH(chan)];
   
-  // Must acquire p->lock in order to
-  // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
-  // so it's okay to release lk.
-
-  acquire(&p->lock);  //DOC: sleeplock1
+  // Must acquire chan's sleep queue lock, and then
+  // p->lock in order to change p->state and then
+  // call sched. Once we hold the queue lock, we can
+  // be guaranteed that we won't miss any wakeup
+  // (wakeup locks the queue), so it's okay to
+  // release lk.
+
+  acquire(&sq->lock);  //DOC: sleeplock1
+  acquire(&p->lock);
   release(lk);
 
   // MLFQ: Process voluntarily gave up CPU before time slice expired
@@ -662,14 +751,27 @@ sleep(void *chan, struct spinlock *lk)
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->sq = sq;
+  p->qnext = sq->head;
+  sq->head = p;
+  release(&sq->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  // wakeup() took p off the queue, unless it was kill()
+  // that woke it. only wakeup() clears p->sq meanwhile.
+  if((sq = p->sq) != 0){
+    acquire(&sq->lock);
+    if(p->sq)
+      sqremove(p);
+    release(&sq->lock);
+  }
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -678,17 +780,23 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
-
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
+  struct sleepq *sq = &sleepq[SLEEPHASH(chan)];
+  struct proc *p, *next;
+
+  acquire(&sq->lock);
+  sq->wakeups++;
+  for(p = sq->head; p; p = next){
+    next = p->qnext;
+    sq->looks++;
+    acquire(&p->lock);
+    if(p->chan == chan){
+      sqremove(p);
+      if(p->state == SLEEPING)
         p->state = RUNNABLE;
-      }
-      release(&p->lock);
     }
+    release(&p->lock);
   }
+  release(&sq->lock);
 }
 
 // Kill the process with the given pid.
@@ -702,9 +810,15 @@ kill(int pid)
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
     if(p->pid == pid){
+      if(p->kfn){
+        // kernel threads never check killed().
+        release(&p->lock);
+        return -1;
+      }
       p->killed = 1;
       if(p->state == SLEEPING){
-        // Wake process from sleep().
+        // Wake process from sleep(), which will
+        // take it off its sleep queue.
         p->state = RUNNABLE;
       }
       release(&p->lock);
@@ -847,6 +961,7 @@ getprocinfo(uint64 addr)
 }
 
 // Set priority for a process (by pid)
+// For a kernel thread this is its new fixed priority
 // Returns 0 on success, -1 on failure
 int
 setprocpriority(int pid, int priority)
@@ -872,85 +987,83 @@ setprocpriority(int pid, int priority)
 }
 
 // Get comprehensive process statistics for MLFQ Monitor TUI
-// Uses kalloc() to avoid kernel stack overflow (~4KB struct on 4KB stack)
+// Copies out one process at a time: struct pstat is bigger than
+// a page, and too large for the kernel stack
 int
 getpstat(uint64 addr)
 {
-  struct pstat *kstat;
+  struct mlfq_stat sys;
+  struct proc_stat ps;
   struct proc *p;
   struct proc *myp = myproc();
-  int i;
-
-  // Allocate kernel buffer on heap (struct pstat is ~4KB, too large for stack)
-  kstat = (struct pstat*)kalloc();
-  if(kstat == 0)
-    return -1;  // Out of memory
+  uint64 dst;
 
-  // Zero out the entire buffer
-  memset(kstat, 0, sizeof(struct pstat));
+  memset(&sys, 0, sizeof(sys));
 
   // Gather system-wide statistics
   acquire(&tickslock);
-  kstat->sys.global_ticks = ticks;
-  kstat->sys.last_boost_tick = last_boost_tick;
+  sys.global_ticks = ticks;
+  sys.last_boost_tick = last_boost_tick;
   release(&tickslock);
 
   acquire(&mlfq_lock);
-  kstat->sys.next_boost_in = BOOST_INTERVAL - (mlfq_ticks % BOOST_INTERVAL);
+  sys.next_boost_in = BOOST_INTERVAL - (mlfq_ticks % BOOST_INTERVAL);
   release(&mlfq_lock);
 
+  for(int i = 0; i < NSLEEPQ; i++){
+    acquire(&sleepq[i].lock);
+    sys.wakeups += sleepq[i].wakeups;
+    sys.wakeup_looks += sleepq[i].looks;
+    release(&sleepq[i].lock);
+  }
+
   // Gather per-process statistics
-  i = 0;
-  for(p = proc; p < &proc[NPROC]; p++, i++) {
+  dst = addr + sizeof(struct mlfq_stat);
+  for(p = proc; p < &proc[NPROC]; p++, dst += sizeof(ps)) {
+    memset(&ps, 0, sizeof(ps));
     acquire(&p->lock);
 
     if(p->state != UNUSED) {
-      kstat->procs[i].inuse = 1;
-      kstat->procs[i].pid = p->pid;
-      kstat->procs[i].ppid = (p->parent) ? p->parent->pid : 0;
-      kstat->procs[i].state = p->state;
-      kstat->procs[i].priority = p->priority;
-      kstat->procs[i].ticks_current = p->ticks_used;
-      kstat->procs[i].ticks_total = p->ticks_total;
-      kstat->procs[i].num_scheduled = p->num_scheduled;
-      kstat->procs[i].num_demoted = p->num_demoted;
-      kstat->procs[i].num_boosted = p->num_boosted;
+      ps.inuse = 1;
+      ps.pid = p->pid;
+      ps.ppid = (p->parent) ? p->parent->pid : 0;
+      ps.state = p->state;
+      ps.priority = p->priority;
+      ps.ticks_current = p->ticks_used;
+      ps.ticks_total = p->ticks_total;
+      ps.num_scheduled = p->num_scheduled;
+      ps.num_demoted = p->num_demoted;
+      ps.num_boosted = p->num_boosted;
+      if(p->kfn)
+        ps.flags |= PSTAT_F_KTHREAD;
 
       // Determine time slice based on current priority
-      if(p->priority == 0)
-        kstat->procs[i].time_slice = MLFQ_TICKS_0;
-      else if(p->priority == 1)
-        kstat->procs[i].time_slice = MLFQ_TICKS_1;
-      else
-        kstat->procs[i].time_slice = MLFQ_TICKS_2;
+      ps.time_slice = get_time_slice(p->priority);
 
       // Copy process name
-      memmove(kstat->procs[i].name, p->name, sizeof(p->name));
+      memmove(ps.name, p->name, sizeof(p->name));
 
       // Update system counters
-      kstat->sys.total_processes++;
+      sys.total_processes++;
       if(p->priority >= 0 && p->priority < NMLFQ)
-        kstat->sys.queue_count[p->priority]++;
+        sys.queue_count[p->priority]++;
 
       if(p->state == RUNNING)
-        kstat->sys.running_count++;
+        sys.running_count++;
       else if(p->state == SLEEPING)
-        kstat->sys.sleeping_count++;
+        sys.sleeping_count++;
       else if(p->state == RUNNABLE)
-        kstat->sys.runnable_count++;
+        sys.runnable_count++;
     }
 
     release(&p->lock);
-  }
 
-  // Copy entire struct to user space
-  if(copyout(myp->pagetable, addr,
-             (char*)kstat, sizeof(struct pstat)) < 0) {
-    kfree(kstat);  // Free on error path!
-    return -1;
+    // copyout() may fault the page in, so not under p->lock
+    if(copyout(myp->pagetable, dst, (char*)&ps, sizeof(ps)) < 0)
+      return -1;
   }
 
-  // Free kernel buffer
-  kfree(kstat);
+  if(copyout(myp->pagetable, addr, (char*)&sys, sizeof(sys)) < 0)
+    return -1;
   return 0;
 }
@@ -24,6 +24,7 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation this cpu's TLB was flushed for
 };
 
 extern struct cpu cpus[NCPU];
@@ -79,6 +80,24 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A region of user memory whose pages are not allocated up front,
+// but filled in by vmfault() (vma.c) the first time they are touched.
+// exec() describes each ELF segment with one of these, and mmap()
+// adds one per mapping.
+struct vma {
+  int used;              // is this slot in use?
+  uint64 start;          // first virtual address (page-aligned)
+  uint64 end;            // one past the last virtual address
+  uint64 fileend;        // bytes below this come from ip; the rest are zero
+  uint off;              // offset in ip corresponding to start
+  int perm;              // PTE_R, PTE_W, PTE_X, PTE_U bits for the pages
+  int flags;             // VMA_*
+  struct inode *ip;      // backing file, or 0 for anonymous memory
+};
+
+#define VMA_MMAP   0x1   // made by mmap(); lies above p->sz
+#define VMA_SHARED 0x2   // MAP_SHARED: dirty pages are written back to ip
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -92,6 +111,10 @@ struct proc {
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
 
+  // p->sq->lock must be held when changing these:
+  struct sleepq *sq;           // Sleep queue p is on, or 0
+  struct proc *qnext;          // Next on sq
+
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
 
@@ -99,11 +122,16 @@ struct proc {
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  uint asid;                   // Address-space ID, if asidgen is current (see vm.c)
+  uint64 asidgen;              // Generation of asid; 0 if none
+  int asidcpu;                 // Hart that last ran p with asid
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // Lazily mapped regions (see vma.c)
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // If non-zero, a kernel thread running kfn()
 
   // MLFQ scheduler fields
   int priority;                // Current priority queue (0=highest, NMLFQ-1=lowest)
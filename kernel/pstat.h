@@ -5,7 +5,9 @@
 #ifndef _PSTAT_H_
 #define _PSTAT_H_
 
-#define PSTAT_NPROC     64    // Must match NPROC in param.h
+#include "param.h"
+
+#define PSTAT_NPROC     NPROC // Process table slots
 #define PSTAT_NAME_LEN  16    // Max process name length
 
 // Process states (matching enum procstate in proc.h)
@@ -34,9 +36,13 @@ struct proc_stat {
   int     num_demoted;        // Number of times demoted
   int     num_boosted;        // Number of times boosted
 
+  int     flags;              // PSTAT_F_* bits
   char    name[PSTAT_NAME_LEN]; // Process name
 };
 
+// proc_stat.flags
+#define PSTAT_F_KTHREAD 0x1   // Kernel thread: fixed priority, no user space
+
 // System-wide MLFQ statistics
 struct mlfq_stat {
   int     global_ticks;       // Current system ticks (uptime)
@@ -47,6 +53,8 @@ struct mlfq_stat {
   int     running_count;      // Number of RUNNING processes
   int     sleeping_count;     // Number of SLEEPING processes
   int     runnable_count;     // Number of RUNNABLE processes
+  uint    wakeups;            // wakeup() calls since boot
+  uint    wakeup_looks;       // Sleeping processes those calls examined
 };
 
 // Complete system snapshot returned by getpstat() syscall
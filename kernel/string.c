@@ -1,13 +1,38 @@
 #include "types.h"
 
+// memset() and memmove() work a 64-bit word at a time,
+// four words per iteration, once the destination (and, for
+// memmove, the source, which must be aligned the same way)
+// reaches an 8-byte boundary. The rest goes a byte at a time.
+
+#define WALIGNED(p) (((uint64)(p) & 7) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w, *wdst;
+
+  if(n >= 32){
+    for(; !WALIGNED(cdst); n--)
+      *cdst++ = c;
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    wdst = (uint64 *) cdst;
+    for(; n >= 32; n -= 32, wdst += 4){
+      wdst[0] = w;
+      wdst[1] = w;
+      wdst[2] = w;
+      wdst[3] = w;
+    }
+    for(; n >= 8; n -= 8)
+      *wdst++ = w;
+    cdst = (char *) wdst;
   }
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -41,11 +66,45 @@ memmove(void *dst, const void *src, uint n)
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(n >= 32 && ((uint64)s & 7) == ((uint64)d & 7)){
+      for(; !WALIGNED(d); n--)
+        *--d = *--s;
+      for(; n >= 32; n -= 32){
+        s -= 32;
+        d -= 32;
+        uint64 w0 = ((uint64 *)s)[0], w1 = ((uint64 *)s)[1];
+        uint64 w2 = ((uint64 *)s)[2], w3 = ((uint64 *)s)[3];
+        ((uint64 *)d)[3] = w3;
+        ((uint64 *)d)[2] = w2;
+        ((uint64 *)d)[1] = w1;
+        ((uint64 *)d)[0] = w0;
+      }
+      for(; n >= 8; n -= 8){
+        s -= 8;
+        d -= 8;
+        *(uint64 *)d = *(uint64 *)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(n >= 32 && ((uint64)s & 7) == ((uint64)d & 7)){
+      for(; !WALIGNED(d); n--)
+        *d++ = *s++;
+      for(; n >= 32; n -= 32, s += 32, d += 32){
+        uint64 w0 = ((uint64 *)s)[0], w1 = ((uint64 *)s)[1];
+        uint64 w2 = ((uint64 *)s)[2], w3 = ((uint64 *)s)[3];
+        ((uint64 *)d)[0] = w0;
+        ((uint64 *)d)[1] = w1;
+        ((uint64 *)d)[2] = w2;
+        ((uint64 *)d)[3] = w3;
+      }
+      for(; n >= 8; n -= 8, s += 8, d += 8)
+        *(uint64 *)d = *(uint64 *)s;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
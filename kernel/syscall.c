@@ -104,6 +104,14 @@ extern uint64 sys_close(void);
 extern uint64 sys_getpinfo(void);
 extern uint64 sys_setpriority(void);
 extern uint64 sys_getpstat(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_bstat(void);
+extern uint64 sys_istat(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_poll(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -132,6 +140,14 @@ static uint64 (*syscalls[])(void) = {
 [SYS_getpinfo]   sys_getpinfo,
 [SYS_setpriority] sys_setpriority,
 [SYS_getpstat]   sys_getpstat,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_bstat]   sys_bstat,
+[SYS_istat]   sys_istat,
+[SYS_fsync]   sys_fsync,
+[SYS_memstat] sys_memstat,
+[SYS_splice]  sys_splice,
+[SYS_poll]    sys_poll,
 };
 
 void
@@ -23,3 +23,11 @@
 #define SYS_getpinfo   22
 #define SYS_setpriority 23
 #define SYS_getpstat   24
+#define SYS_mmap   25
+#define SYS_munmap 26
+#define SYS_bstat  27
+#define SYS_istat  28
+#define SYS_fsync  29
+#define SYS_memstat 30
+#define SYS_splice 31
+#define SYS_poll   32
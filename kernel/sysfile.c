@@ -76,6 +76,8 @@ sys_read(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
+  // fileread() copies out while holding locks.
+  vmprefault(p, n, 1);
   return fileread(f, p, n);
 }
 
@@ -90,6 +92,8 @@ sys_write(void)
   argint(2, &n);
   if(argfd(0, 0, &f) < 0)
     return -1;
+  // filewrite() copies in while holding locks.
+  vmprefault(p, n, 0);
 
   return filewrite(f, p, n);
 }
@@ -116,9 +120,34 @@ sys_fstat(void)
   argaddr(1, &st);
   if(argfd(0, 0, &f) < 0)
     return -1;
+  vmprefault(st, sizeof(struct stat), 1);
   return filestat(f, st);
 }
 
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f);
+}
+
+// splice(in, out, n): move up to n bytes from fd in to fd out,
+// one of which is a pipe, without copying them to user space.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -222,6 +251,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcacheenter(dp->dev, dp->inum, name, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -317,7 +347,7 @@ sys_open(void)
   begin_op();
 
   if(omode & O_CREATE){
-    ip = create(path, T_FILE, 0, 0);
+    ip = create(path, T_FILE, (omode & O_EXTENT) ? FEXTENT : 0, 0);
     if(ip == 0){
       end_op();
       return -1;
@@ -355,6 +385,9 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    f->ra.last = -1;
+    f->ra.next = 0;
+    f->ra.win = 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
@@ -377,7 +410,7 @@ sys_mkdir(void)
   struct inode *ip;
 
   begin_op();
-  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, DHASH, 0)) == 0){
     end_op();
     return -1;
   }
@@ -503,3 +536,69 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// mmap(addr, len, prot, flags, fd, off); addr is only a hint
+// and is ignored. fd is ignored for MAP_ANONYMOUS.
+uint64
+sys_mmap(void)
+{
+  struct file *f = 0;
+  int len, prot, flags, off;
+
+  argint(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if(len <= 0 || off < 0)
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr;
+  int len;
+
+  argaddr(0, &addr);
+  argint(1, &len);
+  if(len <= 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+// Copy the buffer cache's statistics (struct bstat) to user space.
+uint64
+sys_bstat(void)
+{
+  uint64 addr;
+
+  argaddr(0, &addr);
+  return bstat(addr);
+}
+
+// Copy the inode table's statistics (struct istat) to user space.
+uint64
+sys_istat(void)
+{
+  uint64 addr;
+
+  argaddr(0, &addr);
+  return istat(addr);
+}
+
+// poll(fds, nfds, timeout): wait up to timeout ticks (for ever
+// if negative) for one of fds to be ready; see poll.c.
+uint64
+sys_poll(void)
+{
+  uint64 fds;
+  int nfds, timeout;
+
+  argaddr(0, &fds);
+  argint(1, &nfds);
+  argint(2, &timeout);
+  return poll(fds, nfds, timeout);
+}
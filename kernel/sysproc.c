@@ -32,6 +32,9 @@ sys_wait(void)
 {
   uint64 p;
   argaddr(0, &p);
+  // wait() copies out the exit status while holding locks.
+  if(p != 0)
+    vmprefault(p, sizeof(int), 1);
   return wait(p);
 }
 
@@ -119,3 +122,12 @@ sys_setpriority(void)
   argint(1, &priority);
   return setprocpriority(pid, priority);
 }
+
+// Copy the page allocator's statistics (struct memstat) to user space
+uint64
+sys_memstat(void)
+{
+  uint64 addr;
+  argaddr(0, &addr);
+  return memstat(addr);
+}
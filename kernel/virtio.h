@@ -46,8 +46,16 @@
 #define VIRTIO_RING_F_EVENT_IDX     29
 
 // this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// must be a power of two, and at most the
+// device's QUEUE_NUM_MAX (256 for qemu).
+// each request takes one, if the device supports
+// indirect descriptors, and otherwise two more than
+// it has blocks.
+#define NUM 64
+
+// at most this many adjacent blocks are merged
+// into a single disk request.
+#define MAXSEG 32
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -58,6 +66,7 @@ struct virtq_desc {
 };
 #define VRING_DESC_F_NEXT  1 // chained with another descriptor
 #define VRING_DESC_F_WRITE 2 // device writes (vs read)
+#define VRING_DESC_F_INDIRECT 4 // addr is a table of descriptors
 
 // the (entire) avail ring, from the spec.
 struct virtq_avail {
@@ -87,8 +96,8 @@ struct virtq_used {
 #define VIRTIO_BLK_T_OUT 1 // write the disk
 
 // the format of the first descriptor in a disk request.
-// to be followed by two more descriptors containing
-// the block, and a one-byte status.
+// to be followed by descriptors for the data of each
+// block, and then a one-byte status.
 struct virtio_blk_req {
   uint32 type; // VIRTIO_BLK_T_IN or ..._OUT
   uint32 reserved;
@@ -46,16 +46,26 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b; // first of the request's bufs, linked by qnext
     char status;
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
-  
+
+  // indirect descriptor tables, also one-for-one with
+  // descriptors: a header, up to MAXSEG blocks, a status.
+  struct virtq_desc table[NUM][MAXSEG+2];
+  int indirect;    // did the device accept indirect descriptors?
+
+  // requests not yet given to the device, sorted by
+  // blockno so that dispatch() can merge neighbours.
+  struct buf *queue;
+  int nqueue;
+
   struct spinlock vdisk_lock;
-  
+
 } disk;
 
 void
@@ -91,8 +101,8 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk.indirect = (features & (1 << VIRTIO_RING_F_INDIRECT_DESC)) != 0;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -178,7 +188,6 @@ free_desc(int i)
   disk.desc[i].flags = 0;
   disk.desc[i].next = 0;
   disk.free[i] = 1;
-  wakeup(&disk.free[0]);
 }
 
 // free a chain of descriptors.
@@ -196,12 +205,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+allocn_desc(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,64 +220,79 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Give the device one request for the n bufs starting at b,
+// which are linked by qnext and hold adjacent blocks.
+// Returns -1 if there are not enough free descriptors.
+// Caller must hold vdisk_lock.
+static int
+start(struct buf *b, int n)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
-
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+  int idx[MAXSEG+2];
+  struct virtq_desc *d;
+  int id, i;
+
+  // the spec's Section 5.2 says that block operations use a
+  // descriptor for type/reserved/sector, one for each piece
+  // of the data, and one for a 1-byte status result. with
+  // indirect descriptors these live in disk.table[id], and
+  // the request takes just one descriptor from the ring.
+  if(disk.indirect){
+    if((id = alloc_desc()) < 0)
+      return -1;
+    d = disk.table[id];
+    for(i = 0; i < n+2; i++)
+      idx[i] = i;
+    disk.desc[id].addr = (uint64) d;
+    disk.desc[id].len = (n+2) * sizeof(struct virtq_desc);
+    disk.desc[id].flags = VRING_DESC_F_INDIRECT;
+    disk.desc[id].next = 0;
+  } else {
+    if(allocn_desc(idx, n+2) < 0)
+      return -1;
+    id = idx[0];
+    d = disk.desc;
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &disk.ops[id];
 
-  if(write)
+  if(b->qwrite)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
   else
     buf0->type = VIRTIO_BLK_T_IN; // read the disk
   buf0->reserved = 0;
-  buf0->sector = sector;
-
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  buf0->sector = b->blockno * (BSIZE / 512);
+
+  d[idx[0]].addr = (uint64) buf0;
+  d[idx[0]].len = sizeof(struct virtio_blk_req);
+  d[idx[0]].flags = VRING_DESC_F_NEXT;
+  d[idx[0]].next = idx[1];
+
+  struct buf *p = b;
+  for(i = 1; i <= n; i++, p = p->qnext){
+    d[idx[i]].addr = (uint64) p->data;
+    d[idx[i]].len = BSIZE;
+    if(b->qwrite)
+      d[idx[i]].flags = 0; // device reads p->data
+    else
+      d[idx[i]].flags = VRING_DESC_F_WRITE; // device writes p->data
+    d[idx[i]].flags |= VRING_DESC_F_NEXT;
+    d[idx[i]].next = idx[i+1];
+  }
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.info[id].status = 0xff; // device writes 0 on success
+  d[idx[n+1]].addr = (uint64) &disk.info[id].status;
+  d[idx[n+1]].len = 1;
+  d[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  d[idx[n+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record the bufs for virtio_disk_intr().
+  disk.info[id].b = b;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  disk.avail->ring[disk.avail->idx % NUM] = id;
 
   __sync_synchronize();
 
@@ -280,14 +303,106 @@ virtio_disk_rw(struct buf *b, int write)
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  return 0;
+}
+
+// Hand the queued bufs to the device, merging each run of
+// adjacent blocks going the same way into one request.
+// Stops early if the device's ring is full; virtio_disk_intr()
+// calls dispatch() again as requests finish.
+// Caller must hold vdisk_lock.
+static void
+dispatch(void)
+{
+  struct buf *b, *last;
+  int n;
+
+  while((b = disk.queue) != 0){
+    last = b;
+    n = 1;
+    while(n < MAXSEG && last->qnext && last->qnext->qwrite == b->qwrite &&
+          last->qnext->dev == b->dev && last->qnext->blockno == last->blockno + 1){
+      last = last->qnext;
+      n++;
+    }
+    if(start(b, n) < 0)
+      break;
+    disk.queue = last->qnext;
+    disk.nqueue -= n;
+    last->qnext = 0;
+  }
+}
+
+// Add b to the queue, keeping it sorted by block number.
+// Caller must hold vdisk_lock.
+static void
+enqueue(struct buf *b, int write, int async)
+{
+  struct buf **pp;
+
+  b->disk = 1;
+  b->qwrite = write;
+  b->qasync = async;
+  for(pp = &disk.queue; *pp; pp = &(*pp)->qnext)
+    if((*pp)->dev > b->dev || ((*pp)->dev == b->dev && (*pp)->blockno > b->blockno))
+      break;
+  b->qnext = *pp;
+  *pp = b;
+
+  // don't let a long queue sit waiting for a kick.
+  if(++disk.nqueue >= MAXSEG)
+    dispatch();
+}
+
+// Queue a read or write of b and return without waiting for
+// the disk. The caller must hold b's sleep-lock, and must not
+// touch b->data until virtio_disk_wait(b) returns.
+// The request may sit in the queue, to be merged with others,
+// until virtio_disk_wait() or virtio_disk_kick().
+void
+virtio_disk_submit(struct buf *b, int write)
+{
+  acquire(&disk.vdisk_lock);
+  enqueue(b, write, 0);
+  release(&disk.vdisk_lock);
+}
+
+// Wait for the request for b queued by virtio_disk_submit(),
+// sending it and anything queued with it to the disk.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
+    dispatch();
     sleep(b, &disk.vdisk_lock);
   }
+  release(&disk.vdisk_lock);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(b, write);
+  virtio_disk_wait(b);
+}
 
+// Queue a read of b, without waiting for it.
+// When the read finishes, virtio_disk_intr() calls bdone(b).
+void
+virtio_disk_start(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+  enqueue(b, 0, 1);
+  release(&disk.vdisk_lock);
+}
+
+// Send everything queued to the disk.
+void
+virtio_disk_kick(void)
+{
+  acquire(&disk.vdisk_lock);
+  dispatch();
   release(&disk.vdisk_lock);
 }
 
@@ -317,11 +432,24 @@ virtio_disk_intr()
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    disk.info[id].b = 0;
+    free_chain(id);
+    while(b){
+      struct buf *nb = b->qnext;
+      b->qnext = 0;
+      b->disk = 0;   // disk is done with buf
+      if(b->qasync)
+        bdone(b);
+      else
+        wakeup(b);
+      b = nb;
+    }
 
     disk.used_idx += 1;
   }
 
+  // the ring has room again.
+  dispatch();
+
   release(&disk.vdisk_lock);
 }
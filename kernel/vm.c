@@ -5,12 +5,36 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
  */
 pagetable_t kernel_pagetable;
 
+// Address-space IDs tag TLB entries, so that switching
+// between the kernel's and a process's page table needn't
+// flush the TLB. The kernel uses ASID 0. Processes get theirs
+// from uvmsatp() in generations: when the ASIDs run out, a new
+// generation starts, every process gets a new ASID the next
+// time it returns to user space, and each hart flushes its TLB
+// once before it uses an ASID of the new generation.
+// A process whose page table loses mappings drops its ASID
+// (p->asidgen = 0), so stale entries for it on any hart are
+// never used again. A mapping that is added or gains a bit
+// is flushed with uvmflush() on the hart that changed it,
+// and a hart that takes over a process from another flushes
+// the process's ASID, since it may cache entries from before.
+// If the hardware has no ASIDs, processes use ASID 0 too,
+// and trampoline.S flushes the TLB on every switch.
+struct {
+  struct spinlock lock;
+  uint64 gen;   // current generation
+  uint next;    // next unused ASID of this generation
+  uint n;       // number of ASIDs the hardware supports
+} asids;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
@@ -37,6 +61,7 @@ kvmmake(void)
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // mappages() uses megapages from the first 2MB boundary on.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
@@ -64,12 +89,86 @@ kvminithart()
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
-  w_satp(MAKE_SATP(kernel_pagetable));
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
 
   // flush stale entries from the TLB.
   sfence_vma();
 }
 
+// Find out how many ASIDs the hardware supports, by
+// writing all ones to satp's ASID field and reading it back.
+// Called on hart 0 after kvminithart().
+void
+asidinit(void)
+{
+  uint64 satp;
+
+  initlock(&asids.lock, "asids");
+  w_satp(MAKE_SATP(kernel_pagetable, 0) | SATP_ASID_MASK);
+  satp = r_satp();
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
+  sfence_vma();
+  asids.n = ((satp & SATP_ASID_MASK) >> SATP_ASID_SHIFT) + 1;
+  asids.gen = 1;
+  asids.next = 1;
+}
+
+// Return the satp value that switches to p's page table,
+// giving p a new ASID if it doesn't have one of the current
+// generation. Called by usertrapret() with interrupts off.
+// asids.lock is only taken to hand out an ASID or to start
+// a new generation, not on every return to user space.
+uint64
+uvmsatp(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  int id = cpuid();
+  uint64 gen;
+
+  if(asids.n <= 1)
+    return MAKE_SATP(p->pagetable, 0);
+
+  gen = __atomic_load_n(&asids.gen, __ATOMIC_ACQUIRE);
+  if(p->asidgen != gen || c->asidgen != gen){
+    acquire(&asids.lock);
+    if(p->asidgen != asids.gen){
+      if(asids.next == asids.n){
+        __atomic_store_n(&asids.gen, asids.gen + 1, __ATOMIC_RELEASE);
+        asids.next = 1;
+      }
+      p->asid = asids.next++;
+      p->asidgen = asids.gen;
+      p->asidcpu = id;
+    }
+    if(c->asidgen != asids.gen){
+      // this hart may hold entries tagged with
+      // ASIDs of an earlier generation.
+      sfence_vma();
+      c->asidgen = asids.gen;
+    }
+    release(&asids.lock);
+  }
+  if(p->asidcpu != id){
+    // the last hart to run p flushed only its own TLB
+    // after faulting pages in.
+    sfence_vma_asid(p->asid);
+    p->asidcpu = id;
+  }
+  return MAKE_SATP(p->pagetable, p->asid);
+}
+
+// Flush this hart's TLB entry for user address va, whose
+// PTE in pagetable has just become valid or gained a bit,
+// if pagetable is the current process's and has an ASID.
+void
+uvmflush(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+
+  if(p && p->pagetable == pagetable && p->asidgen != 0)
+    sfence_vma_page(va, p->asid);
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -82,6 +181,8 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+// If va lies in a megapage, returns its level-1 PTE,
+// which has PTE_S set.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
@@ -91,17 +192,28 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(*pte & PTE_S)
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
   return &pagetable[PX(0, va)];
 }
 
+// The physical address of the page containing va,
+// given the leaf PTE that maps it.
+static uint64
+leafpa(pte_t pte, uint64 va)
+{
+  if(pte & PTE_S)
+    return PTE2PA(pte) + (PGROUNDDOWN(va) - SUPERPGROUNDDOWN(va));
+  return PTE2PA(pte);
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -121,7 +233,7 @@ walkaddr(pagetable_t pagetable, uint64 va)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = leafpa(*pte, va);
   return pa;
 }
 
@@ -138,13 +250,16 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa.
 // va and size MUST be page-aligned.
+// Where va and pa are both 2MB-aligned, at least 2MB remain,
+// and no level-0 page-table page is in the way, maps a
+// megapage with a single level-1 PTE.
 // Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
   uint64 a, last;
-  pte_t *pte;
+  pte_t *pte, *pde;
 
   if((va % PGSIZE) != 0)
     panic("mappages: va not aligned");
@@ -158,6 +273,27 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = va;
   last = va + size - PGSIZE;
   for(;;){
+    if(a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 &&
+       last - a >= SUPERPGSIZE - PGSIZE){
+      pde = &pagetable[PX(2, a)];
+      if((*pde & PTE_V) == 0){
+        pagetable_t l1 = (pagetable_t)kalloc_zeroed();
+        if(l1 == 0)
+          return -1;
+        *pde = PA2PTE(l1) | PTE_V;
+      }
+      if(*pde & PTE_S)
+        panic("mappages: remap");
+      pte = &((pagetable_t)PTE2PA(*pde))[PX(1, a)];
+      if((*pte & PTE_V) == 0){
+        *pte = PA2PTE(pa) | perm | PTE_S | PTE_V;
+        if(a + SUPERPGSIZE - PGSIZE == last)
+          break;
+        a += SUPERPGSIZE;
+        pa += SUPERPGSIZE;
+        continue;
+      }
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
@@ -171,23 +307,60 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// Replace the megapage at va, mapped by *pte, with 512
+// ordinary mappings of the same memory, except for the
+// page at hole, which is about to be unmapped: its memory
+// becomes the new level-0 page-table page.
+static void
+demote(pte_t *pte, uint64 va, uint64 hole)
+{
+  uint64 pa = PTE2PA(*pte);
+  int perm = PTE_FLAGS(*pte) & ~PTE_S;
+  pagetable_t l0 = (pagetable_t)(pa + (hole - va));
+
+  ksplit((void*)pa);
+  memset(l0, 0, PGSIZE);
+  for(int i = 0; i < 512; i++){
+    if(va + i*PGSIZE != hole)
+      l0[i] = PA2PTE(pa + i*PGSIZE) | perm;
+  }
+  *pte = PA2PTE(l0) | PTE_V;
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never mapped (parts of a
+// lazily loaded vma that were never touched) are skipped.
+// A megapage that is only partly unmapped is first split
+// into ordinary pages.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, end;
   pte_t *pte;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
+    if(*pte & PTE_S){
+      if(a % SUPERPGSIZE == 0 && a + SUPERPGSIZE <= end){
+        if(do_free)
+          kfree((void*)PTE2PA(*pte));
+        *pte = 0;
+        a += SUPERPGSIZE - PGSIZE;
+        continue;
+      }
+      if(!do_free)
+        panic("uvmunmap: part of megapage");
+      demote(pte, SUPERPGROUNDDOWN(a), a);
+      continue;
+    }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -204,10 +377,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -221,14 +393,15 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
 
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Uses megapages for the 2MB-aligned parts of the new
+// memory while superalloc() has some to give.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
@@ -240,12 +413,22 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    if(a % SUPERPGSIZE == 0 && a + SUPERPGSIZE <= newsz &&
+       walk(pagetable, a, 0) == 0 && (mem = superalloc()) != 0){
+      memset(mem, 0, SUPERPGSIZE);
+      if(mappages(pagetable, a, SUPERPGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
+        kfree(mem);
+        uvmdealloc(pagetable, a, oldsz);
+        return 0;
+      }
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -306,7 +489,12 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 // Given a parent process's page table, copy
 // its memory into a child's page table.
 // Copies both the page table and the
-// physical memory.
+// physical memory, except for read-only pages,
+// which the child shares with the parent.
+// Pages the parent never faulted in are left
+// for the child to fault in from its own vmas.
+// A megapage is copied into a new megapage if
+// there is one, and into ordinary pages if not.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
@@ -319,11 +507,27 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 
   for(i = 0; i < sz; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
-    pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
+      continue;
+    pa = leafpa(*pte, i);
+    flags = PTE_FLAGS(*pte) & ~PTE_S;
+    if((*pte & PTE_S) && i % SUPERPGSIZE == 0 && walk(new, i, 0) == 0 &&
+       (mem = superalloc()) != 0){
+      memmove(mem, (char*)pa, SUPERPGSIZE);
+      if(mappages(new, i, SUPERPGSIZE, (uint64)mem, flags) != 0){
+        kfree(mem);
+        goto err;
+      }
+      i += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    if((flags & PTE_W) == 0 && (*pte & PTE_S) == 0){
+      if(mappages(new, i, PGSIZE, pa, flags) != 0)
+        goto err;
+      kdup((void*)pa);
+      continue;
+    }
     if((mem = kalloc()) == 0)
       goto err;
     memmove(mem, (char*)pa, PGSIZE);
@@ -352,6 +556,42 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Translate user page va0 for copyin(), copyout() and
+// copyinstr(), faulting it in if need be. *ppte is the PTE
+// the copy used for the page before va0, or 0, and is updated;
+// consecutive pages in the same level-0 page-table page or
+// megapage are found without walking the page table again.
+// Returns the physical address of the page, or 0 if the
+// user may not access it.
+static uint64
+uvmtranslate(pagetable_t pagetable, pte_t **ppte, uint64 va0, int write)
+{
+  pte_t *pte = *ppte;
+
+  if(va0 >= MAXVA)
+    return 0;
+  if(pte && (*pte & PTE_V) && va0 % SUPERPGSIZE != 0){
+    if((*pte & PTE_S) == 0)
+      pte++;
+  } else {
+    pte = walk(pagetable, va0, 0);
+  }
+  if((pte == 0 || (*pte & PTE_V) == 0) && vmfault(pagetable, va0, write) == 0)
+    pte = walk(pagetable, va0, 0);
+  *ppte = pte;
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  if(write){
+    if((*pte & PTE_W) == 0)
+      return 0;
+    if((*pte & PTE_D) == 0){
+      *pte |= PTE_D;  // the kernel's writes count too; see munmap().
+      uvmflush(pagetable, va0);
+    }
+  }
+  return leafpa(*pte, va0);
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -359,17 +599,12 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
-  pte_t *pte;
+  pte_t *pte = 0;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    if(va0 >= MAXVA)
-      return -1;
-    pte = walk(pagetable, va0, 0);
-    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ||
-       (*pte & PTE_W) == 0)
+    if((pa0 = uvmtranslate(pagetable, &pte, va0, 1)) == 0)
       return -1;
-    pa0 = PTE2PA(*pte);
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -389,11 +624,11 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte = 0;
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = uvmtranslate(pagetable, &pte, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
@@ -415,12 +650,12 @@ int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
   uint64 n, va0, pa0;
+  pte_t *pte = 0;
   int got_null = 0;
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = uvmtranslate(pagetable, &pte, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
@@ -0,0 +1,479 @@
+//
+// Demand paging of user memory, and mmap().
+//
+// exec() does not read a program into memory. It records
+// each ELF segment as a struct vma in the process, and
+// vmfault() allocates and fills a page the first time the
+// program (or copyin/copyout on its behalf) touches it.
+//
+// mmap() works the same way: it adds a vma, placed top-down
+// below TRAPFRAME, backed by a file or by zero pages. Pages
+// of a MAP_SHARED file mapping that the hardware (or
+// copyout()) marked dirty are written back to the file by
+// munmap() and when the process exits or execs.
+//
+// Read-only pages (program text and rodata) never change,
+// so vmfault() keeps recently loaded ones in a small cache
+// keyed by (dev, inum, va) and maps the same physical page
+// into every process that runs the same binary.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+
+struct {
+  struct spinlock lock;
+  struct {
+    uint dev;
+    uint inum;
+    uint64 va;
+    char *pa;   // 0 if this slot is free; holds a kdup() reference
+  } page[NTEXTPAGE];
+  int hand;     // where to start looking for a page to evict
+} textcache;
+
+void
+vmainit(void)
+{
+  initlock(&textcache.lock, "textcache");
+}
+
+// Look for the page of ip at va in the text cache.
+// Returns it with an extra reference, or 0.
+static char*
+textget(struct inode *ip, uint64 va)
+{
+  char *pa = 0;
+
+  acquire(&textcache.lock);
+  for(int i = 0; i < NTEXTPAGE; i++){
+    if(textcache.page[i].pa && textcache.page[i].dev == ip->dev &&
+       textcache.page[i].inum == ip->inum && textcache.page[i].va == va){
+      pa = textcache.page[i].pa;
+      kdup(pa);
+      break;
+    }
+  }
+  release(&textcache.lock);
+  return pa;
+}
+
+// Remember pa as the contents of ip at va.
+// Only evicts pages that no process has mapped;
+// if there is no such slot, pa just isn't cached.
+static void
+textput(struct inode *ip, uint64 va, char *pa)
+{
+  int i, slot = -1;
+
+  acquire(&textcache.lock);
+  for(i = 0; i < NTEXTPAGE; i++){
+    if(textcache.page[i].pa == 0){
+      if(slot < 0)
+        slot = i;
+    } else if(textcache.page[i].dev == ip->dev &&
+              textcache.page[i].inum == ip->inum && textcache.page[i].va == va){
+      // another process loaded the same page concurrently.
+      release(&textcache.lock);
+      return;
+    }
+  }
+  for(i = 0; slot < 0 && i < NTEXTPAGE; i++){
+    int j = (textcache.hand + i) % NTEXTPAGE;
+    if(krefcnt(textcache.page[j].pa) == 1){
+      kfree(textcache.page[j].pa);
+      textcache.page[j].pa = 0;
+      slot = j;
+      textcache.hand = (j + 1) % NTEXTPAGE;
+    }
+  }
+  if(slot >= 0){
+    kdup(pa);
+    textcache.page[slot].dev = ip->dev;
+    textcache.page[slot].inum = ip->inum;
+    textcache.page[slot].va = va;
+    textcache.page[slot].pa = pa;
+  }
+  release(&textcache.lock);
+}
+
+// Forget any cached pages of ip, because its contents
+// are about to change. Processes that already map
+// them keep their (now stale) copies. Caller holds
+// ip->lock, or ip has no references.
+void
+textdrop(struct inode *ip)
+{
+  ip->textcached = 0;
+  acquire(&textcache.lock);
+  for(int i = 0; i < NTEXTPAGE; i++){
+    if(textcache.page[i].pa && textcache.page[i].dev == ip->dev &&
+       textcache.page[i].inum == ip->inum){
+      kfree(textcache.page[i].pa);
+      textcache.page[i].pa = 0;
+    }
+  }
+  release(&textcache.lock);
+}
+
+// Return the vma of the current process that contains va, or 0.
+static struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->used && va >= v->start && va < v->end)
+      return v;
+  }
+  return 0;
+}
+
+// Handle a fault on user virtual address va in pagetable,
+// which must be the current process's: allocate the page,
+// fill it from the vma that covers va, and map it.
+// Called from usertrap() and by copyin()/copyout().
+// Returns 0 on success, -1 if va isn't in a vma or the
+// access isn't allowed.
+int
+vmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  uint64 a;
+  uint n;
+  int text;
+
+  if(p == 0 || p->pagetable != pagetable || va >= MAXVA)
+    return -1;
+
+  a = PGROUNDDOWN(va);
+  if((v = vmafind(p, a)) == 0)
+    return -1;
+  if((v->perm & (PTE_R|PTE_X)) == 0 || (write && (v->perm & PTE_W) == 0))
+    return -1;
+  if((pte = walk(pagetable, a, 0)) != 0 && (*pte & PTE_V))
+    return -1; // present, so this is a protection fault.
+
+  // read-only program pages can be shared with other processes.
+  text = (v->flags & VMA_MMAP) == 0 && (v->perm & PTE_W) == 0;
+  if(text && (mem = textget(v->ip, a)) != 0)
+    goto map;
+
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  if(v->ip && (a < v->fileend || text)){
+    ilock(v->ip);
+    if(a < v->fileend){
+      n = PGSIZE;
+      if(v->fileend - a < PGSIZE)
+        n = v->fileend - a;
+      // a short read means the page runs past the end of
+      // the file; the rest of it stays zero.
+      if(readi(v->ip, 0, (uint64)mem, v->off + (a - v->start), n) < 0){
+        iunlock(v->ip);
+        kfree(mem);
+        return -1;
+      }
+    }
+    if(text){
+      // cache it before a write can change the file, and
+      // tell writei() and itrunc() to call textdrop().
+      v->ip->textcached = 1;
+      textput(v->ip, a, mem);
+    }
+    iunlock(v->ip);
+  }
+
+ map:
+  if(mappages(pagetable, a, PGSIZE, (uint64)mem, v->perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  uvmflush(pagetable, a);
+  return 0;
+}
+
+// Fault in the not-yet-loaded pages of the current process
+// in [va, va+len), so that a copyout() or copyin() made later
+// while holding a spinlock or a buffer/inode sleep-lock
+// doesn't have to read the backing file. Addresses that
+// can't be faulted in are left for the copy to report.
+void
+vmprefault(uint64 va, uint64 len, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint64 a;
+
+  for(a = PGROUNDDOWN(va); a < va + len && a < MAXVA; a += PGSIZE){
+    if((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & PTE_V))
+      continue;
+    if(vmfault(p->pagetable, a, write) < 0)
+      break;
+  }
+}
+
+// Write the dirty pages of a MAP_SHARED mapping in
+// [va, va+len) back to the file, and unmap and free
+// all pages of v in that range.
+// Must not be called inside a transaction.
+static void
+vmaunmap(pagetable_t pagetable, struct vma *v, uint64 va, uint64 len)
+{
+  pte_t *pte;
+  uint64 a;
+  uint off, n;
+
+  for(a = va; a < va + len; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    if((v->flags & VMA_SHARED) && v->ip && (*pte & PTE_D) && a < v->fileend){
+      off = v->off + (a - v->start);
+      begin_op();
+      ilock(v->ip);
+      // don't grow the file: only write back what it already holds.
+      if(off < v->ip->size){
+        n = PGSIZE;
+        if(v->fileend - a < n)
+          n = v->fileend - a;
+        if(v->ip->size - off < n)
+          n = v->ip->size - off;
+        writei(v->ip, 0, PTE2PA(*pte), off, n);
+      }
+      iunlock(v->ip);
+      end_op();
+    }
+    uvmunmap(pagetable, a, 1, 1);
+  }
+}
+
+// Lowest address in use by mmap(), which places new
+// mappings below it. The heap must stay under it.
+uint64
+mmapbase(struct proc *p)
+{
+  uint64 base = TRAPFRAME;
+
+  for(int i = 0; i < NVMA; i++){
+    if(p->vma[i].used && (p->vma[i].flags & VMA_MMAP) && p->vma[i].start < base)
+      base = p->vma[i].start;
+  }
+  return base;
+}
+
+// Map len bytes of f starting at off (or zero-filled memory, if
+// flags has MAP_ANONYMOUS) into the current process.
+// Returns the address of the mapping, or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v = 0;
+  uint64 va;
+  int i;
+
+  if(len == 0 || off % PGSIZE != 0)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0){
+    if(f == 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+
+  len = PGROUNDUP(len);
+  va = mmapbase(p);
+  if(va < len || va - len < PGROUNDUP(p->sz))
+    return -1;
+  va -= len;
+
+  for(i = 0; i < NVMA; i++){
+    if(p->vma[i].used == 0){
+      v = &p->vma[i];
+      break;
+    }
+  }
+  if(v == 0)
+    return -1;
+
+  v->used = 1;
+  v->start = va;
+  v->end = va + len;
+  v->off = off;
+  v->perm = PTE_U;
+  if(prot & PROT_READ)
+    v->perm |= PTE_R;
+  if(prot & PROT_WRITE)
+    v->perm |= PTE_R | PTE_W;
+  if(prot & PROT_EXEC)
+    v->perm |= PTE_X;
+  v->flags = VMA_MMAP;
+  if(flags & MAP_SHARED)
+    v->flags |= VMA_SHARED;
+  if(flags & MAP_ANONYMOUS){
+    v->ip = 0;
+    v->fileend = va;
+  } else {
+    v->ip = idup(f->ip);
+    v->fileend = va + len;
+  }
+  return va;
+}
+
+// Remove the mappings of the current process in [va, va+len),
+// writing back dirty MAP_SHARED pages.
+// The range must lie in one mmap()ed region and include its
+// first or last page; punching a hole in the middle isn't supported.
+// Returns 0 on success, -1 on error.
+int
+munmap(uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  struct inode *ip;
+
+  if(va % PGSIZE != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if((v = vmafind(p, va)) == 0 || (v->flags & VMA_MMAP) == 0)
+    return -1;
+  if(va + len > v->end || (va != v->start && va + len != v->end))
+    return -1;
+
+  vmaunmap(p->pagetable, v, va, len);
+  p->asidgen = 0; // the TLB may hold the freed pages; see vm.c.
+
+  if(va == v->start && va + len == v->end){
+    ip = v->ip;
+    v->used = 0;
+    v->ip = 0;
+    if(ip){
+      begin_op();
+      iput(ip);
+      end_op();
+    }
+  } else if(va == v->start){
+    v->start += len;
+    v->off += len;
+    if(v->fileend < v->start)
+      v->fileend = v->start;
+  } else {
+    v->end = va;
+    if(v->fileend > v->end)
+      v->fileend = v->end;
+  }
+  return 0;
+}
+
+// Fault in every page of p's MAP_SHARED regions, so that
+// vmadup() can map the same physical pages into a child.
+// Called by fork() before it takes any locks.
+// Returns 0 on success, -1 if out of memory.
+int
+vmashare(struct proc *p)
+{
+  pte_t *pte;
+  uint64 a;
+
+  for(int i = 0; i < NVMA; i++){
+    struct vma *v = &p->vma[i];
+    if(!v->used || (v->flags & VMA_SHARED) == 0)
+      continue;
+    for(a = v->start; a < v->end; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & PTE_V))
+        continue;
+      if(vmfault(p->pagetable, a, 0) < 0)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+// Give child np copies of p's vmas. Pages of MAP_SHARED
+// regions are shared, pages of private mmap() regions are
+// copied; pages below p->sz are left to uvmcopy().
+// Doesn't sleep, so fork() can call it holding np->lock.
+// Returns 0 on success, -1 if out of memory.
+int
+vmadup(struct proc *np, struct proc *p)
+{
+  pte_t *pte;
+  uint64 a, pa;
+  char *mem;
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    struct vma *v = &p->vma[i];
+    np->vma[i] = *v;
+    if(!v->used || (v->flags & VMA_MMAP) == 0)
+      continue;
+    for(a = v->start; a < v->end; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      pa = PTE2PA(*pte);
+      if(v->flags & VMA_SHARED){
+        if(mappages(np->pagetable, a, PGSIZE, pa, PTE_FLAGS(*pte)) != 0)
+          goto err;
+        kdup((void*)pa);
+      } else {
+        if((mem = kalloc()) == 0)
+          goto err;
+        memmove(mem, (char*)pa, PGSIZE);
+        if(mappages(np->pagetable, a, PGSIZE, (uint64)mem, PTE_FLAGS(*pte)) != 0){
+          kfree(mem);
+          goto err;
+        }
+      }
+    }
+  }
+  for(i = 0; i < NVMA; i++){
+    if(np->vma[i].used && np->vma[i].ip)
+      idup(np->vma[i].ip);
+  }
+  return 0;
+
+ err:
+  for(i = 0; i < NVMA; i++){
+    if(np->vma[i].used && (np->vma[i].flags & VMA_MMAP))
+      uvmunmap(np->pagetable, np->vma[i].start,
+               (np->vma[i].end - np->vma[i].start) / PGSIZE, 1);
+    np->vma[i].used = 0;
+  }
+  return -1;
+}
+
+// Release the vmas in vma[0..NVMA-1], unmapping the
+// mmap() regions from pagetable (writing back dirty
+// shared pages) if pagetable isn't 0.
+// Must not be called inside a transaction.
+void
+vmaput(pagetable_t pagetable, struct vma *vma)
+{
+  for(int i = 0; i < NVMA; i++){
+    if(vma[i].used && (vma[i].flags & VMA_MMAP) && pagetable)
+      vmaunmap(pagetable, &vma[i], vma[i].start, vma[i].end - vma[i].start);
+  }
+  begin_op();
+  for(int i = 0; i < NVMA; i++){
+    if(vma[i].used && vma[i].ip)
+      iput(vma[i].ip);
+    vma[i].used = 0;
+    vma[i].ip = 0;
+  }
+  end_op();
+}
@@ -15,7 +15,7 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 12000
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
@@ -77,8 +77,20 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc > 2 && strcmp(argv[1], "-l") == 0){
+    nlog = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l logblocks] fs.img files...\n");
+    exit(1);
+  }
+  // the header block lists the rest, and the kernel
+  // needs room for at least one FS operation.
+  if(nlog - 1 > LOGMAX || nlog - 1 < MAXOPBLOCKS){
+    fprintf(stderr, "mkfs: log must be %d to %d blocks\n",
+            MAXOPBLOCKS + 1, (int)LOGMAX + 1);
     exit(1);
   }
 
@@ -257,7 +269,8 @@ iappend(uint inum, void *xp, int n)
   struct dinode din;
   char buf[BSIZE];
   uint indirect[NINDIRECT];
-  uint x;
+  uint x, bn, span, *slot;
+  int level;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -271,15 +284,28 @@ iappend(uint inum, void *xp, int n)
       }
       x = xint(din.addrs[fbn]);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
+      // same walk as bmap() in kernel/fs.c.
+      bn = fbn - NDIRECT;
+      span = NINDIRECT;
+      for(level = 0; bn >= span; level++){
+        bn -= span;
+        span *= NINDIRECT;
+      }
+      slot = &din.addrs[NDIRECT+level];
+      if(xint(*slot) == 0){
+        *slot = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      x = xint(*slot);
+      for(; level >= 0; level--){
+        span /= NINDIRECT;
+        rsect(x, (char*)indirect);
+        if(indirect[bn / span] == 0){
+          indirect[bn / span] = xint(freeblock++);
+          wsect(x, (char*)indirect);
+        }
+        x = xint(indirect[bn / span]);
+        bn %= span;
       }
-      x = xint(indirect[fbn-NDIRECT]);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -0,0 +1,129 @@
+// bcachetest.c - Stress the buffer cache from several processes
+// Each child repeatedly reads its own small file, checking the contents,
+// so that nearly every bread() is a cache hit and the cost is the
+// lookup itself. Run on several harts, this shows how much bget()
+// lookups contend with each other. A second phase has every child read
+// files of all the others, so buffers are shared and recycled.
+//
+// Usage: bcachetest [rounds]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/bstat.h"
+#include "user/user.h"
+
+#define NCHILD 4
+#define FILEBLOCKS 4
+
+static char buf[BSIZE];
+
+static void fname(char *name, int i) {
+  strcpy(name, "bcache.0");
+  name[7] = '0' + i;
+}
+
+static void makefile(int i) {
+  char name[16];
+  int fd;
+
+  fname(name, i);
+  unlink(name);
+  if ((fd = open(name, O_CREATE | O_WRONLY)) < 0) {
+    printf("bcachetest: create %s failed\n", name);
+    exit(1);
+  }
+  memset(buf, 'a' + i, sizeof(buf));
+  for (int b = 0; b < FILEBLOCKS; b++) {
+    if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
+      printf("bcachetest: write %s failed\n", name);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+static void readfile(int i) {
+  char name[16];
+  int fd, n;
+
+  fname(name, i);
+  if ((fd = open(name, O_RDONLY)) < 0) {
+    printf("bcachetest: open %s failed\n", name);
+    exit(1);
+  }
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    for (int j = 0; j < n; j++) {
+      if (buf[j] != 'a' + i) {
+        printf("bcachetest: %s has wrong contents\n", name);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+}
+
+// Run NCHILD children that each call readfile() rounds times,
+// on their own file or on all of them, and return the ticks taken.
+static int run(int rounds, int shared) {
+  int start = uptime();
+
+  for (int c = 0; c < NCHILD; c++) {
+    int pid = fork();
+    if (pid < 0) {
+      printf("bcachetest: fork failed\n");
+      exit(1);
+    }
+    if (pid == 0) {
+      for (int r = 0; r < rounds; r++) {
+        readfile(shared ? (c + r) % NCHILD : c);
+      }
+      exit(0);
+    }
+  }
+  for (int c = 0; c < NCHILD; c++) {
+    int status;
+    wait(&status);
+    if (status != 0) {
+      printf("bcachetest: FAILED\n");
+      exit(1);
+    }
+  }
+  return uptime() - start;
+}
+
+int main(int argc, char *argv[]) {
+  int rounds = 500;
+
+  if (argc > 1) {
+    rounds = atoi(argv[1]);
+  }
+
+  printf("bcachetest: %d children, %d rounds\n", NCHILD, rounds);
+  for (int i = 0; i < NCHILD; i++) {
+    makefile(i);
+  }
+
+  printf("  private files: %d ticks\n", run(rounds, 0));
+  printf("  shared files:  %d ticks\n", run(rounds, 1));
+
+  struct bstat st;
+  if (bstat(&st) < 0) {
+    printf("bcachetest: bstat failed\n");
+    exit(1);
+  }
+  printf("  cache: %d/%d buffers, %d hits, %d misses, %d evictions\n",
+         st.nbuf, st.maxbuf, st.hits, st.misses, st.evictions);
+  printf("         %d pages added, %d given back\n", st.grows, st.shrinks);
+  printf("         %d blocks read ahead, %d of them used\n",
+         st.readahead, st.aheadhits);
+
+  for (int i = 0; i < NCHILD; i++) {
+    char name[16];
+    fname(name, i);
+    unlink(name);
+  }
+  printf("bcachetest: OK\n");
+  exit(0);
+}
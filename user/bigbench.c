@@ -0,0 +1,104 @@
+// bigbench.c - Measure sequential throughput on a multi-megabyte file
+// Writes a file far past what the singly-indirect block can map, so
+// most of it goes through the doubly-indirect tree, fsync()s it so the
+// flusher's write-back is counted, then reads it back and checks every
+// block. Prints KB moved per tick each way. With a second argument
+// of 1 the file is mapped with extents (O_EXTENT) instead.
+//
+// Usage: bigbench [megabytes] [extent]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define CHUNK (64 * 1024)
+
+static char *name = "bigbench.tmp";
+
+// Stamp each block of the chunk with its block number in the file.
+static void fill(char *buf, int chunk) {
+  for (int b = 0; b < CHUNK / BSIZE; b++) {
+    int bn = chunk * (CHUNK / BSIZE) + b;
+    memset(buf + b * BSIZE, bn & 0xff, BSIZE);
+    *(int *)(buf + b * BSIZE) = bn;
+  }
+}
+
+static int check(char *buf, int chunk) {
+  for (int b = 0; b < CHUNK / BSIZE; b++) {
+    int bn = chunk * (CHUNK / BSIZE) + b;
+    if (*(int *)(buf + b * BSIZE) != bn ||
+        (uchar)buf[b * BSIZE + BSIZE - 1] != (bn & 0xff)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int mb = 8, extent = 0;
+  char *buf;
+
+  if (argc > 1) {
+    mb = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    extent = atoi(argv[2]);
+  }
+  if ((buf = malloc(CHUNK)) == 0) {
+    printf("bigbench: malloc failed\n");
+    exit(1);
+  }
+  int nchunk = mb * (1024 * 1024 / CHUNK);
+
+  printf("bigbench: %d MB %s file\n", mb, extent ? "extent" : "indirect");
+
+  int fd = open(name, O_CREATE | O_TRUNC | O_WRONLY | (extent ? O_EXTENT : 0));
+  if (fd < 0) {
+    printf("bigbench: create failed\n");
+    exit(1);
+  }
+  int start = uptime();
+  for (int c = 0; c < nchunk; c++) {
+    fill(buf, c);
+    if (write(fd, buf, CHUNK) != CHUNK) {
+      printf("bigbench: write failed at %d KB\n", c * (CHUNK / 1024));
+      exit(1);
+    }
+  }
+  if (fsync(fd) < 0) {
+    printf("bigbench: fsync failed\n");
+    exit(1);
+  }
+  close(fd);
+  int wticks = uptime() - start;
+
+  if ((fd = open(name, O_RDONLY)) < 0) {
+    printf("bigbench: open failed\n");
+    exit(1);
+  }
+  start = uptime();
+  for (int c = 0; c < nchunk; c++) {
+    if (read(fd, buf, CHUNK) != CHUNK || check(buf, c) < 0) {
+      printf("bigbench: bad data at %d KB\n", c * (CHUNK / 1024));
+      exit(1);
+    }
+  }
+  if (read(fd, buf, CHUNK) != 0) {
+    printf("bigbench: file too long\n");
+    exit(1);
+  }
+  close(fd);
+  int rticks = uptime() - start;
+
+  int kb = mb * 1024;
+  printf("  write: %d ticks, %d KB/tick\n", wticks, wticks > 0 ? kb / wticks : kb);
+  printf("  read:  %d ticks, %d KB/tick\n", rticks, rticks > 0 ? kb / rticks : kb);
+
+  unlink(name);
+  free(buf);
+  printf("bigbench: OK\n");
+  exit(0);
+}
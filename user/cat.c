@@ -10,6 +10,13 @@ cat(int fd)
 {
   int n;
 
+  // if fd or the output is a pipe, let the kernel move the
+  // data; otherwise splice() fails at once, and we copy.
+  while((n = splice(fd, 1, 8192)) > 0)
+    ;
+  if(n == 0)
+    return;
+
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       fprintf(2, "cat: write error\n");
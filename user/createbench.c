@@ -0,0 +1,104 @@
+// createbench.c - Measure metadata throughput with create/unlink storms
+// Each of several children, over and over, creates a batch of empty
+// files in its own directory and then unlinks them. Every create and
+// unlink is a small transaction that rewrites the same few inode and
+// directory blocks, so this is dominated by the cost of committing to
+// the log, and shows how much group commit and absorption save.
+//
+// Usage: createbench [children] [rounds]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NFILE 20   // files per child per round
+
+static void fname(char *name, int c, int i) {
+  strcpy(name, "cb0/f00");
+  name[2] = '0' + c;
+  name[5] = '0' + i / 10;
+  name[6] = '0' + i % 10;
+}
+
+static void storm(int c, int rounds) {
+  char name[16];
+
+  for (int r = 0; r < rounds; r++) {
+    for (int i = 0; i < NFILE; i++) {
+      fname(name, c, i);
+      int fd = open(name, O_CREATE | O_RDWR);
+      if (fd < 0) {
+        printf("createbench: create %s failed\n", name);
+        exit(1);
+      }
+      close(fd);
+    }
+    for (int i = 0; i < NFILE; i++) {
+      fname(name, c, i);
+      if (unlink(name) < 0) {
+        printf("createbench: unlink %s failed\n", name);
+        exit(1);
+      }
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int nchild = 4, rounds = 10;
+  char dir[4];
+
+  if (argc > 1) {
+    nchild = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    rounds = atoi(argv[2]);
+  }
+  if (nchild < 1 || nchild > 6) {
+    printf("createbench: need 1-6 children\n");
+    exit(1);
+  }
+
+  printf("createbench: %d children, %d rounds of %d files\n",
+         nchild, rounds, NFILE);
+  strcpy(dir, "cb0");
+  for (int c = 0; c < nchild; c++) {
+    dir[2] = '0' + c;
+    if (mkdir(dir) < 0) {
+      printf("createbench: mkdir %s failed\n", dir);
+      exit(1);
+    }
+  }
+
+  int start = uptime();
+  for (int c = 0; c < nchild; c++) {
+    int pid = fork();
+    if (pid < 0) {
+      printf("createbench: fork failed\n");
+      exit(1);
+    }
+    if (pid == 0) {
+      storm(c, rounds);
+      exit(0);
+    }
+  }
+  for (int c = 0; c < nchild; c++) {
+    int status;
+    wait(&status);
+    if (status != 0) {
+      printf("createbench: FAILED\n");
+      exit(1);
+    }
+  }
+  int ticks = uptime() - start;
+
+  for (int c = 0; c < nchild; c++) {
+    dir[2] = '0' + c;
+    unlink(dir);
+  }
+
+  int ops = 2 * nchild * rounds * NFILE;
+  printf("  %d creates+unlinks in %d ticks, %d per tick\n",
+         ops, ticks, ticks > 0 ? ops / ticks : ops);
+  exit(0);
+}
@@ -0,0 +1,103 @@
+// dirbench.c - Measure creating and looking up files in a big directory
+// Creates many empty files in one directory, opens each of them again
+// by name, and then unlinks them, timing each phase. Directories made
+// by mkdir() are hashed, so each lookup searches one short chain of
+// blocks; passing "/" as the directory uses the root directory that
+// mkfs made, which is searched from start to end.
+//
+// Usage: dirbench [files] [dir]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/istat.h"
+#include "user/user.h"
+
+static char *dir = "dirbench.d";
+
+// dir/fNNNNN
+static void fname(char *name, int i) {
+  int n = strlen(dir);
+
+  strcpy(name, dir);
+  if (n == 0 || name[n - 1] != '/') {
+    name[n++] = '/';
+  }
+  name[n++] = 'f';
+  for (int d = 10000; d > 0; d /= 10) {
+    name[n++] = '0' + (i / d) % 10;
+  }
+  name[n] = 0;
+}
+
+int main(int argc, char *argv[]) {
+  int nfile = 10000;
+  int made = 0;
+  char name[64];
+
+  if (argc > 1) {
+    nfile = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    dir = argv[2];
+  } else if (mkdir(dir) < 0) {
+    printf("dirbench: mkdir %s failed\n", dir);
+    exit(1);
+  }
+  if (nfile < 1 || nfile > 99999 || strlen(dir) > sizeof(name) - 8) {
+    printf("dirbench: bad arguments\n");
+    exit(1);
+  }
+
+  printf("dirbench: %d files in %s\n", nfile, dir);
+
+  int start = uptime();
+  for (int i = 0; i < nfile; i++) {
+    fname(name, i);
+    int fd = open(name, O_CREATE | O_RDWR);
+    if (fd < 0) {
+      printf("dirbench: create %s failed\n", name);
+      break;
+    }
+    close(fd);
+    made++;
+  }
+  printf("  create: %d files, %d ticks\n", made, uptime() - start);
+
+  start = uptime();
+  for (int i = 0; i < made; i++) {
+    fname(name, i);
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+      printf("dirbench: open %s failed\n", name);
+      exit(1);
+    }
+    close(fd);
+  }
+  printf("  lookup: %d ticks\n", uptime() - start);
+
+  start = uptime();
+  for (int i = 0; i < made; i++) {
+    fname(name, i);
+    if (unlink(name) < 0) {
+      printf("dirbench: unlink %s failed\n", name);
+      exit(1);
+    }
+  }
+  printf("  unlink: %d ticks\n", uptime() - start);
+
+  struct istat st;
+  if (istat(&st) == 0) {
+    printf("  inode table: %d/%d in use, %d hits, %d misses\n",
+           st.inuse, st.ninode, st.hits, st.misses);
+  }
+
+  if (argc <= 2) {
+    unlink(dir);
+  }
+  if (made < nfile) {
+    exit(1);
+  }
+  printf("dirbench: OK\n");
+  exit(0);
+}
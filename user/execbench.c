@@ -0,0 +1,82 @@
+// execbench.c - Measure exec() latency
+// Repeatedly fork()s a child that exec()s this program again with
+// the "-x" flag, which exits as soon as main() runs, and times the
+// same number of fork()s of a child that exits without exec(). The
+// difference is the time exec() takes to reach the first user
+// instruction, so it shows the effect of loading pages on demand.
+// Also reports how many of the zeroed pages fork() and exec() asked
+// for came ready-made from the zeroer's pool.
+//
+// Usage: execbench [iterations]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+static char *args[] = { "execbench", "-x", 0 };
+
+// Run iterations fork+wait rounds, with children that exec()
+// this program if doexec, and otherwise exit at once.
+// Returns the ticks they took.
+static int rounds(int iterations, int doexec) {
+  int start = uptime();
+  for (int i = 0; i < iterations; i++) {
+    int pid = fork();
+    if (pid < 0) {
+      printf("execbench: fork failed\n");
+      exit(1);
+    }
+    if (pid == 0) {
+      if (doexec) {
+        exec("execbench", args);
+        printf("execbench: exec failed\n");
+        exit(1);
+      }
+      exit(0);
+    }
+    int status;
+    wait(&status);
+    if (status != 0) {
+      exit(1);
+    }
+  }
+  return uptime() - start;
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = 200;
+
+  if (argc > 1 && strcmp(argv[1], "-x") == 0) {
+    // Child: got to the first instruction of main(), done.
+    exit(0);
+  }
+  if (argc > 1) {
+    iterations = atoi(argv[1]);
+  }
+  if (iterations < 1) {
+    printf("execbench: bad iteration count\n");
+    exit(1);
+  }
+
+  printf("execbench: %d iterations\n", iterations);
+
+  struct memstat m0, m1;
+  if (memstat(&m0) < 0) {
+    printf("execbench: memstat failed\n");
+    exit(1);
+  }
+
+  int base = rounds(iterations, 0);
+  int total = rounds(iterations, 1);
+  int etime = total > base ? total - base : 0;
+
+  printf("  fork+exit:      %d ticks\n", base);
+  printf("  fork+exec+exit: %d ticks\n", total);
+  printf("  exec alone:     %d ticks, %d ticks per 1000 execs\n",
+         etime, etime * 1000 / iterations);
+  memstat(&m1);
+  printf("  zeroed pages: %d from the pool, %d zeroed on demand, %d pooled now\n",
+         m1.zhits - m0.zhits, m1.zmisses - m0.zmisses, m1.nzero);
+  exit(0);
+}
@@ -0,0 +1,95 @@
+// lowmemtest.c - Run file system benchmarks while memory is short
+// A child sbrk()s until fewer than LOWPAGES free pages are left, well
+// under BUFRESERVE, so the buffer cache can't grow into free memory
+// the usual way, and holds on to that memory while bigbench and
+// createbench run. Big writes and create storms keep many blocks
+// pinned in the log, and the cache must still find buffers for them.
+//
+// Usage: lowmemtest
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+#define LOWPAGES (BUFRESERVE / 2)
+#define STEP (64 * 4096)
+
+static void fail(char *msg) {
+  printf("lowmemtest: FAILED: %s\n", msg);
+  exit(1);
+}
+
+static int freepages(void) {
+  struct memstat m;
+
+  if (memstat(&m) < 0) {
+    fail("memstat");
+  }
+  return m.nfree + m.nzero;
+}
+
+// Fork a child that takes all but LOWPAGES free pages and keeps
+// them until p[1] is closed. Returns once it has them.
+static int hog(int p[2]) {
+  char c;
+
+  if (pipe(p) < 0) {
+    fail("pipe");
+  }
+  int pid = fork();
+  if (pid < 0) {
+    fail("fork");
+  }
+  if (pid == 0) {
+    int n = 0;
+    while (freepages() > LOWPAGES && sbrk(STEP) != (char *)-1) {
+      n++;
+    }
+    printf("lowmemtest: took %d KB, %d pages left free\n",
+           n * (STEP / 1024), freepages());
+    write(p[1], "x", 1);
+    close(p[1]);
+    read(p[0], &c, 1);
+    exit(0);
+  }
+  if (read(p[0], &c, 1) != 1) {
+    fail("hog");
+  }
+  close(p[0]);
+  return pid;
+}
+
+static void run(char **argv) {
+  int status;
+
+  int pid = fork();
+  if (pid < 0) {
+    fail("fork");
+  }
+  if (pid == 0) {
+    exec(argv[0], argv);
+    printf("lowmemtest: exec %s failed\n", argv[0]);
+    exit(1);
+  }
+  wait(&status);
+  if (status != 0) {
+    fail(argv[0]);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  char *big[] = { "bigbench", 0 };
+  char *create[] = { "createbench", 0 };
+  int p[2];
+
+  hog(p);
+  run(big);
+  run(create);
+  close(p[1]);
+  wait(0);
+
+  printf("lowmemtest: OK\n");
+  exit(0);
+}
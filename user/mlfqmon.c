@@ -52,7 +52,7 @@ void draw_bar(int count, int max, char c) {
 }
 
 int main(int argc, char *argv[]) {
-  struct procinfo pinfo[NPROC];
+  static struct procinfo pinfo[NPROC];  // too big for the stack at large NPROC
   int interval = 10;  // Default: refresh every 10 ticks
   int iterations = 0;
   int max_iterations = 50;  // Run for ~50 refreshes then exit
@@ -0,0 +1,141 @@
+// mmaptest.c - Test mmap() and munmap()
+// Checks that a file mapping reads the same bytes as read(), that
+// writes to a MAP_PRIVATE mapping don't reach the file, that writes
+// to a MAP_SHARED mapping do once it is unmapped, and that anonymous
+// memory starts zeroed and MAP_SHARED pages are shared across fork().
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define FILESIZE (3 * 4096 + 100)  // ends partway into a page
+
+static char buf[FILESIZE];
+
+static void fail(char *msg) {
+  printf("mmaptest: FAILED: %s\n", msg);
+  exit(1);
+}
+
+static void makefile(char *name) {
+  int fd;
+
+  for (int i = 0; i < FILESIZE; i++) {
+    buf[i] = 'a' + i % 23;
+  }
+  unlink(name);
+  if ((fd = open(name, O_CREATE | O_RDWR)) < 0) {
+    fail("create");
+  }
+  if (write(fd, buf, FILESIZE) != FILESIZE) {
+    fail("write");
+  }
+  close(fd);
+}
+
+static void checkfile(char *name, char *want) {
+  static char got[FILESIZE];
+  int fd;
+
+  if ((fd = open(name, O_RDONLY)) < 0) {
+    fail("open");
+  }
+  if (read(fd, got, FILESIZE) != FILESIZE) {
+    fail("read back");
+  }
+  close(fd);
+  if (memcmp(got, want, FILESIZE) != 0) {
+    fail("file contents");
+  }
+}
+
+int main(int argc, char *argv[]) {
+  char *name = "mmaptest.tmp";
+  char *p;
+  int fd;
+
+  printf("Starting mmap() test...\n");
+
+  // MAP_PRIVATE: contents match, writes stay private.
+  makefile(name);
+  if ((fd = open(name, O_RDONLY)) < 0) {
+    fail("open");
+  }
+  p = mmap(0, FILESIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == (char *)-1) {
+    fail("mmap private");
+  }
+  if (memcmp(p, buf, FILESIZE) != 0) {
+    fail("private contents");
+  }
+  for (int i = FILESIZE; i < 4 * 4096; i++) {
+    if (p[i] != 0) {
+      fail("page past end of file not zero");
+    }
+  }
+  p[0] = 'X';
+  if (munmap(p, FILESIZE) < 0) {
+    fail("munmap private");
+  }
+  checkfile(name, buf);
+  printf("  MAP_PRIVATE ok\n");
+
+  // MAP_SHARED: writes reach the file; unmap in two pieces.
+  if ((fd = open(name, O_RDWR)) < 0) {
+    fail("open");
+  }
+  p = mmap(0, FILESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == (char *)-1) {
+    fail("mmap shared");
+  }
+  p[0] = buf[0] = 'Y';
+  p[FILESIZE - 1] = buf[FILESIZE - 1] = 'Z';
+  if (munmap(p, 4096) < 0 || munmap(p + 4096, FILESIZE - 4096) < 0) {
+    fail("munmap shared");
+  }
+  checkfile(name, buf);
+  printf("  MAP_SHARED ok\n");
+
+  // A read-only descriptor can't back a writable shared mapping.
+  if ((fd = open(name, O_RDONLY)) < 0) {
+    fail("open");
+  }
+  if (mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) != (char *)-1) {
+    fail("writable MAP_SHARED of read-only fd");
+  }
+  close(fd);
+
+  // Anonymous shared memory: zeroed, and shared with a child.
+  p = mmap(0, 2 * 4096, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (p == (char *)-1) {
+    fail("mmap anonymous");
+  }
+  for (int i = 0; i < 2 * 4096; i++) {
+    if (p[i] != 0) {
+      fail("anonymous memory not zero");
+    }
+  }
+  int pid = fork();
+  if (pid < 0) {
+    fail("fork");
+  }
+  if (pid == 0) {
+    p[4096] = 42;
+    exit(0);
+  }
+  wait(0);
+  if (p[4096] != 42) {
+    fail("child's write not visible");
+  }
+  if (munmap(p, 2 * 4096) < 0) {
+    fail("munmap anonymous");
+  }
+  printf("  MAP_ANONYMOUS ok\n");
+
+  unlink(name);
+  printf("\nTest PASSED\n");
+  exit(0);
+}
@@ -1,12 +1,14 @@
 // monitor.c - MLFQ Scheduler Monitor TUI
 // Real-time visualization of Multi-Level Feedback Queue scheduler
 // Usage: monitor [iterations] [refresh_interval]
-// Note: xv6 doesn't handle Ctrl+C. Wait for iterations to finish or use Ctrl+A X to exit QEMU.
+// Type q and Enter to quit early; the refresh wait is a poll() on the
+// console, so keystrokes are seen at once rather than after a sleep.
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/param.h"
 #include "kernel/pstat.h"
+#include "kernel/poll.h"
 #include "user/user.h"
 
 // ============================================================================
@@ -310,8 +312,18 @@ void draw_process_table(struct pstat *ps)
       print_int_r(ps->procs[i].pid, 4);
       printf(" | ");
       
-      // NAME (12 chars left-aligned)
-      print_str_l(ps->procs[i].name, 12);
+      // NAME (12 chars left-aligned), kernel threads in brackets
+      if(ps->procs[i].flags & PSTAT_F_KTHREAD) {
+        char kname[PSTAT_NAME_LEN + 2];
+        int n = strlen(ps->procs[i].name);
+        kname[0] = '[';
+        memmove(kname + 1, ps->procs[i].name, n);
+        kname[n + 1] = ']';
+        kname[n + 2] = 0;
+        print_str_l(kname, 12);
+      } else {
+        print_str_l(ps->procs[i].name, 12);
+      }
       printf(" | ");
       
       // STATE (7 chars left-aligned)
@@ -363,12 +375,31 @@ void draw_footer(int interval)
   printf("Refresh: ");
   printf("%d", interval);
   printf(" ticks\n");
-  printf("  Wait for iterations to finish (xv6 doesn't support Ctrl+C)\n");
+  printf("  Type q and Enter to quit\n");
   printf("+");
   draw_line(80, '-');
   printf("+\n");
 }
 
+// Wait up to interval ticks for the next refresh, returning early
+// with 1 if a line starting with 'q' is typed on the console.
+int wait_key(int interval)
+{
+  struct pollfd pfd;
+  char line[32];
+
+  pfd.fd = 0;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  if(poll(&pfd, 1, interval) <= 0)
+    return 0;
+  if(pfd.revents & POLLHUP)
+    return 1;
+  if(read(0, line, sizeof(line)) <= 0)
+    return 1;
+  return line[0] == 'q' || line[0] == 'Q';
+}
+
 // ============================================================================
 // Main
 // ============================================================================
@@ -407,7 +438,7 @@ int main(int argc, char *argv[])
   printf("  Iterations: %d\n", max_iter);
   printf("  Refresh interval: %d ticks\n", interval);
   printf("  ANSI colors: %s\n", use_ansi ? "enabled" : "disabled");
-  printf("\nNote: xv6 doesn't support Ctrl+C. Wait for iterations or Ctrl+A X to exit QEMU.\n");
+  printf("\nType q and Enter at any time to quit.\n");
   printf("\nStarting in 2 seconds...\n");
   sleep(20);  // ~2 seconds
   
@@ -417,7 +448,8 @@ int main(int argc, char *argv[])
   }
   
   // Main loop
-  for(int iter = 1; iter <= max_iter; iter++) {
+  int iter;
+  for(iter = 1; iter <= max_iter; iter++) {
     // Get process info
     if(getpstat(ps) < 0) {
       printf("monitor: getpstat failed\n");
@@ -438,16 +470,19 @@ int main(int argc, char *argv[])
     draw_process_table(ps);
     draw_footer(interval);
     
-    // Wait for next refresh
-    sleep(interval);
+    // Wait for next refresh, or for the user to quit
+    if(wait_key(interval))
+      break;
   }
+  if(iter > max_iter)
+    iter = max_iter;
   
   // Show cursor again
   if(use_ansi) {
     printf(ANSI_SHOW_CURSOR);
   }
   
-  printf("\nMonitor finished after %d iterations.\n", max_iter);
+  printf("\nMonitor finished after %d iterations.\n", iter);
   free(ps);
   exit(0);
 }
@@ -0,0 +1,87 @@
+// pipebench.c - Measure pipe bandwidth
+// A child writes a stream of bytes into a pipe in chunks of a given
+// size while the parent reads it back in chunks of the same size and
+// checks the pattern. Prints KB moved per tick, which shows the cost
+// of the copy and of waking the other end.
+//
+// Usage: pipebench [megabytes] [chunk]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int main(int argc, char *argv[]) {
+  int mb = 16, chunk = 4096;
+  int fds[2];
+  char *buf;
+
+  if (argc > 1) {
+    mb = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    chunk = atoi(argv[2]);
+  }
+  if (mb < 1 || chunk < 1) {
+    printf("pipebench: bad arguments\n");
+    exit(1);
+  }
+  if ((buf = malloc(chunk)) == 0) {
+    printf("pipebench: malloc failed\n");
+    exit(1);
+  }
+  if (pipe(fds) < 0) {
+    printf("pipebench: pipe failed\n");
+    exit(1);
+  }
+
+  printf("pipebench: %d MB in %d-byte chunks\n", mb, chunk);
+  int total = mb * 1024 * 1024;
+  int start = uptime();
+
+  int pid = fork();
+  if (pid < 0) {
+    printf("pipebench: fork failed\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    for (int off = 0; off < total; ) {
+      int n = total - off < chunk ? total - off : chunk;
+      for (int i = 0; i < n; i++) {
+        buf[i] = (off + i) & 0xff;
+      }
+      if (write(fds[1], buf, n) != n) {
+        printf("pipebench: write failed\n");
+        exit(1);
+      }
+      off += n;
+    }
+    exit(0);
+  }
+
+  close(fds[1]);
+  int got = 0, n;
+  while ((n = read(fds[0], buf, chunk)) > 0) {
+    for (int i = 0; i < n; i++) {
+      if ((uchar)buf[i] != ((got + i) & 0xff)) {
+        printf("pipebench: bad data at %d\n", got + i);
+        exit(1);
+      }
+    }
+    got += n;
+  }
+  close(fds[0]);
+  int status;
+  wait(&status);
+  int ticks = uptime() - start;
+
+  if (got != total || status != 0) {
+    printf("pipebench: got %d of %d bytes\n", got, total);
+    exit(1);
+  }
+  int kb = total / 1024;
+  printf("  %d ticks, %d KB/tick\n", ticks, ticks > 0 ? kb / ticks : kb);
+  free(buf);
+  printf("pipebench: OK\n");
+  exit(0);
+}
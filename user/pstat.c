@@ -27,7 +27,7 @@ static char *states[] = {
 };
 
 int main(int argc, char *argv[]) {
-  struct procinfo pinfo[NPROC];
+  static struct procinfo pinfo[NPROC];  // too big for the stack at large NPROC
   
   if (getpinfo(pinfo) < 0) {
     printf("getpinfo failed\n");
@@ -0,0 +1,93 @@
+// rwbench.c - Measure read()/write() bandwidth by buffer size
+// Writes and then reads back a file with each buffer size from 4KB to
+// 1MB, several times over, and prints KB moved per tick. Small buffers
+// are dominated by system call overhead, large ones by copyin() and
+// copyout() moving the data between user and kernel memory.
+//
+// Usage: rwbench [rounds]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define FILESIZE (256 * 1024)  // must fit in one file
+#define MAXBUF   (1024 * 1024)
+
+static char *name = "rwbench.tmp";
+
+static int writefile(char *buf, int bufsize) {
+  int fd = open(name, O_CREATE | O_TRUNC | O_WRONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  for (int left = FILESIZE; left > 0; ) {
+    int n = left < bufsize ? left : bufsize;
+    if (write(fd, buf, n) != n) {
+      close(fd);
+      return -1;
+    }
+    left -= n;
+  }
+  close(fd);
+  return 0;
+}
+
+static int readfile(char *buf, int bufsize) {
+  int fd = open(name, O_RDONLY);
+  int n, total = 0;
+  if (fd < 0) {
+    return -1;
+  }
+  while ((n = read(fd, buf, bufsize)) > 0) {
+    total += n;
+  }
+  close(fd);
+  return total == FILESIZE ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+  int rounds = 10;
+  char *buf;
+
+  if (argc > 1) {
+    rounds = atoi(argv[1]);
+  }
+  if ((buf = malloc(MAXBUF)) == 0) {
+    printf("rwbench: malloc failed\n");
+    exit(1);
+  }
+  memset(buf, 'x', MAXBUF);
+
+  printf("rwbench: %d KB file, %d rounds per buffer size\n",
+         FILESIZE / 1024, rounds);
+  printf("bufsize(KB)  write(KB/tick)  read(KB/tick)\n");
+
+  for (int bufsize = 4096; bufsize <= MAXBUF; bufsize *= 4) {
+    int start = uptime();
+    for (int i = 0; i < rounds; i++) {
+      if (writefile(buf, bufsize) < 0) {
+        printf("rwbench: write failed\n");
+        exit(1);
+      }
+    }
+    int wticks = uptime() - start;
+
+    start = uptime();
+    for (int i = 0; i < rounds; i++) {
+      if (readfile(buf, bufsize) < 0) {
+        printf("rwbench: read failed\n");
+        exit(1);
+      }
+    }
+    int rticks = uptime() - start;
+
+    int kb = rounds * (FILESIZE / 1024);
+    printf("%d  %d  %d\n", bufsize / 1024,
+           wticks > 0 ? kb / wticks : kb, rticks > 0 ? kb / rticks : kb);
+  }
+
+  unlink(name);
+  free(buf);
+  exit(0);
+}
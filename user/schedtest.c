@@ -23,7 +23,7 @@ struct procinfo {
 
 // Helper to find process priority by PID
 int get_priority(int target_pid) {
-  struct procinfo pinfo[NPROC];
+  static struct procinfo pinfo[NPROC];  // too big for the stack at large NPROC
   if (getpinfo(pinfo) < 0) return -1;
   
   for (int i = 0; i < NPROC; i++) {
@@ -0,0 +1,72 @@
+// syscallbench.c - Measure system call and context switch latency
+// Times a loop of getpid() calls, which cross into the kernel and back
+// without doing any work there, and a one-byte ping-pong between two
+// processes over a pair of pipes, which also switches address spaces
+// on every round trip. Both are sensitive to how much of the TLB
+// survives each switch of page table.
+//
+// Usage: syscallbench [iterations]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int main(int argc, char *argv[]) {
+  int iterations = 100000;
+  int start, elapsed;
+
+  if (argc > 1) {
+    iterations = atoi(argv[1]);
+  }
+
+  printf("syscallbench: %d getpid() calls\n", iterations);
+  start = uptime();
+  for (int i = 0; i < iterations; i++) {
+    getpid();
+  }
+  elapsed = uptime() - start;
+  printf("syscallbench: getpid: %d ticks, %d calls per tick\n",
+         elapsed, elapsed > 0 ? iterations / elapsed : iterations);
+
+  int ping[2], pong[2];
+  char c = 0;
+  int rounds = iterations / 10;
+
+  if (pipe(ping) < 0 || pipe(pong) < 0) {
+    printf("syscallbench: pipe failed\n");
+    exit(1);
+  }
+  int pid = fork();
+  if (pid < 0) {
+    printf("syscallbench: fork failed\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    // Child: echo every byte back.
+    close(ping[1]);
+    close(pong[0]);
+    while (read(ping[0], &c, 1) == 1) {
+      write(pong[1], &c, 1);
+    }
+    exit(0);
+  }
+  close(ping[0]);
+  close(pong[1]);
+
+  printf("syscallbench: %d pipe round trips\n", rounds);
+  start = uptime();
+  for (int i = 0; i < rounds; i++) {
+    if (write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1) {
+      printf("syscallbench: ping-pong failed\n");
+      exit(1);
+    }
+  }
+  elapsed = uptime() - start;
+  close(ping[1]);
+  close(pong[0]);
+  wait(0);
+
+  printf("syscallbench: ping-pong: %d ticks, %d round trips per tick\n",
+         elapsed, elapsed > 0 ? rounds / elapsed : rounds);
+  exit(0);
+}
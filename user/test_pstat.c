@@ -37,6 +37,21 @@ int main(int argc, char *argv[])
   printf("  Queue 1 (MED):    %d\n", ps->sys.queue_count[1]);
   printf("  Queue 2 (LOW):    %d\n", ps->sys.queue_count[2]);
 
+  // Kernel threads (logger, flusher) are flagged
+  int nkthread = 0;
+  for(int i = 0; i < PSTAT_NPROC; i++) {
+    if(ps->procs[i].inuse && (ps->procs[i].flags & PSTAT_F_KTHREAD)) {
+      printf("  Kernel thread:    %s (pid %d, queue %d)\n",
+             ps->procs[i].name, ps->procs[i].pid, ps->procs[i].priority);
+      nkthread++;
+    }
+  }
+  if(nkthread == 0) {
+    printf("ERROR: no kernel threads reported\n");
+    free(ps);
+    exit(1);
+  }
+
   printf("\nTest PASSED\n");
   free(ps);
   exit(0);
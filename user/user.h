@@ -1,4 +1,5 @@
 struct stat;
+struct pollfd;
 
 // system calls
 int fork(void);
@@ -25,6 +26,14 @@ int uptime(void);
 int getpinfo(void*);
 int setpriority(int, int);
 int getpstat(void*);
+void *mmap(void*, uint, int, int, int, uint);
+int munmap(void*, uint);
+int bstat(void*);
+int istat(void*);
+int fsync(int);
+int memstat(void*);
+int splice(int, int, int);
+int poll(struct pollfd*, int, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -39,3 +39,11 @@ entry("uptime");
 entry("getpinfo");
 entry("setpriority");
 entry("getpstat");
+entry("mmap");
+entry("munmap");
+entry("bstat");
+entry("istat");
+entry("fsync");
+entry("memstat");
+entry("splice");
+entry("poll");
@@ -0,0 +1,123 @@
+// wakebench.c - Measure the per-tick cost of wakeup() as processes pile up
+// For a growing number of idle children, each blocked reading its own
+// end of a pipe, spins for a while calling uptime() and reports, per
+// tick, the wakeup() calls made, the sleeping processes they looked at,
+// and how many uptime() calls the spinner still got through. With
+// hashed sleep queues the looks stay flat as children are added; a
+// scan of proc[] would look at all NPROC slots on every call.
+// Build with e.g. make NPROC=256 to try hundreds of processes.
+//
+// Usage: wakebench [maxchildren] [ticks]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/pstat.h"
+#include "user/user.h"
+
+static struct pstat *ps;
+
+// Spin for ticks ticks; return uptime() calls made, and the
+// wakeup() counters' growth in *wakeups and *looks.
+static int spin(int ticks, uint *wakeups, uint *looks) {
+  int n = 0;
+
+  if (getpstat(ps) < 0) {
+    printf("wakebench: getpstat failed\n");
+    exit(1);
+  }
+  *wakeups = ps->sys.wakeups;
+  *looks = ps->sys.wakeup_looks;
+
+  int start = uptime();
+  while (uptime() == start)
+    ;
+  start++;
+  while (uptime() < start + ticks) {
+    n++;
+  }
+
+  if (getpstat(ps) < 0) {
+    printf("wakebench: getpstat failed\n");
+    exit(1);
+  }
+  *wakeups = ps->sys.wakeups - *wakeups;
+  *looks = ps->sys.wakeup_looks - *looks;
+  return n;
+}
+
+// Fork up to n children that sleep reading p[0] until p[1]
+// is closed. Returns how many were started.
+static int idle(int n, int p[2]) {
+  int i;
+
+  for (i = 0; i < n; i++) {
+    int pid = fork();
+    if (pid < 0) {
+      break;
+    }
+    if (pid == 0) {
+      char c;
+      close(p[1]);
+      read(p[0], &c, 1);
+      exit(0);
+    }
+  }
+  return i;
+}
+
+static void run(int n, int ticks) {
+  int p[2];
+  uint wakeups, looks;
+
+  if (pipe(p) < 0) {
+    printf("wakebench: pipe failed\n");
+    exit(1);
+  }
+  int got = idle(n, p);
+  close(p[0]);
+  sleep(2);  // let them all block
+
+  int calls = spin(ticks, &wakeups, &looks);
+
+  close(p[1]);
+  for (int i = 0; i < got; i++) {
+    wait(0);
+  }
+
+  printf("  %d\t%d\t%d\t%d\t%d\n", got, wakeups / ticks, looks / ticks,
+         wakeups > 0 ? looks / wakeups : 0, calls / ticks);
+  if (got < n) {
+    printf("wakebench: fork failed after %d children\n", got);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int max = NPROC - 8, ticks = 100;
+
+  if (argc > 1) {
+    max = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    ticks = atoi(argv[2]);
+  }
+  if (max < 0 || ticks < 1) {
+    printf("wakebench: bad arguments\n");
+    exit(1);
+  }
+  if ((ps = malloc(sizeof(struct pstat))) == 0) {
+    printf("wakebench: malloc failed\n");
+    exit(1);
+  }
+
+  printf("wakebench: NPROC %d, %d ticks per run\n", NPROC, ticks);
+  printf("  idle\twakeups\tlooks\tlooks\tuptime()\n");
+  printf("  procs\t/tick\t/tick\t/wakeup\t/tick\n");
+  for (int n = 0; n < max; n = n ? 2 * n : 8) {
+    run(n, ticks);
+  }
+  run(max, ticks);
+
+  free(ps);
+  exit(0);
+}